@@ -10,6 +10,8 @@
 #include "objects/object.h"
 #include "objects/symtab.h"
 
+#include <cstdlib>
+
 #define lnerr_(t, ...)                                     \
 	{                                                      \
 		Printer::LnErr(t, ##__VA_ARGS__);                  \
@@ -40,6 +42,9 @@ CodeGenerator::CodeGenerator() {
 	btx                = NULL;
 	corectx            = Value(ExecutionEngine::CoreObject).getClass();
 	currentlyCompiling = nullptr;
+	inlining           = nullptr;
+	inlineSlot         = 0;
+	fold               = std::getenv("NEXT_NO_FOLD") == nullptr;
 
 	expressionNoPop = false;
 }
@@ -147,8 +152,10 @@ CodeGenerator::CompilationState CodeGenerator::getState() {
 }
 
 void CodeGenerator::popFrame() {
-	if(btx != NULL)
+	if(btx != NULL) {
+		btx->code->finalize(ftx->f);
 		btx->finalize();
+	}
 	ftx = ctx->get_default_constructor();
 	if(ftx != NULL)
 		btx = ftx->get_codectx();
@@ -185,11 +192,285 @@ void CodeGenerator::patchBreaks() {
 	}
 }
 
+int CodeGenerator::localSlot(Expression *e) {
+	if(onLHS || onRefer || e->type != Expression::EXPR_Variable ||
+	   e->token.type != Token::Type::TOKEN_IDENTIFIER)
+		return -1;
+	VarInfo v = lookForVariable2(String::from(e->token.start, e->token.length));
+	return v.position == LOCAL ? v.slot : -1;
+}
+
+static bool hasRegisterForm(Token::Type t) {
+	switch(t) {
+		case Token::Type::TOKEN_PLUS:
+		case Token::Type::TOKEN_MINUS:
+		case Token::Type::TOKEN_STAR:
+		case Token::Type::TOKEN_SLASH:
+		case Token::Type::TOKEN_LESS:
+		case Token::Type::TOKEN_LESS_EQUAL:
+		case Token::Type::TOKEN_GREATER:
+		case Token::Type::TOKEN_GREATER_EQUAL: return true;
+		default: return false;
+	}
+}
+
+bool CodeGenerator::emitRegisterBinary(BinaryExpression *bin, int dest) {
+	if(!hasRegisterForm(bin->token.type))
+		return false;
+	int   right    = localSlot(bin->right);
+	Value constant = ValueNil;
+	if(right == -1) {
+		// a number constant is used as a constant operand
+		if(dest != -1 || !constantValue(bin->right, constant) ||
+		   !constant.isNumber())
+			return false;
+	}
+	int left = localSlot(bin->left);
+	if(left == -1) {
+		if(dest != -1)
+			return false;
+		bin->left->accept(this);
+	}
+	btx->insert_token(bin->token);
+	// the slow paths push both of the operands
+	btx->stackEffect(2);
+	btx->stackEffect(-2);
+	switch(bin->token.type) {
+#define REGISTER_FORM(tok, op)                \
+	case Token::Type::tok:                    \
+		if(right == -1 && left == -1)         \
+			btx->op##_tc(constant);           \
+		else if(right == -1)                  \
+			btx->op##_sc(left, constant);     \
+		else if(left == -1)                   \
+			btx->op##_ts(right);              \
+		else if(dest == -1)                   \
+			btx->op##_ss(left, right);        \
+		else                                  \
+			btx->op##_sss(left, right);       \
+		break;
+		REGISTER_FORM(TOKEN_PLUS, add)
+		REGISTER_FORM(TOKEN_MINUS, sub)
+		REGISTER_FORM(TOKEN_STAR, mul)
+		REGISTER_FORM(TOKEN_SLASH, div)
+		REGISTER_FORM(TOKEN_LESS, less)
+		REGISTER_FORM(TOKEN_LESS_EQUAL, lesseq)
+		REGISTER_FORM(TOKEN_GREATER, greater)
+		REGISTER_FORM(TOKEN_GREATER_EQUAL, greatereq)
+#undef REGISTER_FORM
+		default: break;
+	}
+	// the _sss opcodes perform this themselves, it is
+	// only executed when the operator method is called
+	if(dest != -1)
+		btx->store_slot_pop(dest);
+	return true;
+}
+
+bool CodeGenerator::emitRegisterAssign(Expression *e) {
+	if(e->type != Expression::EXPR_Assign)
+		return false;
+	AssignExpression *as = (AssignExpression *)e;
+	if(as->target->type != Expression::EXPR_Variable ||
+	   as->val->type != Expression::EXPR_Binary)
+		return false;
+	BinaryExpression *bin = (BinaryExpression *)as->val;
+	// check the operands before the target is declared,
+	// so that it cannot be referred to in the value
+	if(!hasRegisterForm(bin->token.type) || localSlot(bin->left) == -1 ||
+	   localSlot(bin->right) == -1)
+		return false;
+	VarInfo target = lookForVariable(as->target->token, true);
+	if(target.position != LOCAL)
+		return false;
+	btx->insert_token(as->val->token);
+	return emitRegisterBinary(bin, target.slot);
+}
+
+// the truth value of a value, as tested by the engine
+static bool isFalsey(Value v) {
+	return v == ValueNil || v == ValueFalse || v == ValueZero;
+}
+
+bool CodeGenerator::constantValue(Expression *e, Value &res) {
+	if(e->type == Expression::EXPR_Literal) {
+		res = ((LiteralExpression *)e)->value;
+		return true;
+	}
+	if(!fold)
+		return false;
+	switch(e->type) {
+		case Expression::EXPR_Grouping: {
+			GroupingExpression *g = (GroupingExpression *)e;
+			return !g->istuple && g->exprs->size == 1 &&
+			       constantValue(g->exprs->values[0].toExpression(), res);
+		}
+		case Expression::EXPR_Prefix: {
+			PrefixExpression *pe = (PrefixExpression *)e;
+			Value             r;
+			if(!constantValue(pe->right, r))
+				return false;
+			switch(pe->token.type) {
+				case Token::Type::TOKEN_PLUS: res = r; return true;
+				case Token::Type::TOKEN_BANG:
+					res = Value(isFalsey(r));
+					return true;
+				case Token::Type::TOKEN_MINUS:
+					if(!r.isNumber())
+						return false;
+					res.setNumber(-r.toNumber());
+					return true;
+				case Token::Type::TOKEN_TILDE:
+					if(!r.isInteger())
+						return false;
+					res.setInteger(~r.toInteger());
+					return true;
+				default: return false;
+			}
+		}
+		case Expression::EXPR_Binary: break;
+		default: return false;
+	}
+	BinaryExpression *bin = (BinaryExpression *)e;
+	Value             l, r;
+	if(!constantValue(bin->left, l))
+		return false;
+	// the right operand may allocate a string, so the left
+	// one is kept alive until the result is computed
+	String2 ls = l.isString() ? l.toString() : nullptr;
+	if(!constantValue(bin->right, r))
+		return false;
+	String2 rs = r.isString() ? r.toString() : nullptr;
+	switch(bin->token.type) {
+		case Token::Type::TOKEN_and:
+			res = isFalsey(l) ? l : r;
+			return true;
+		case Token::Type::TOKEN_or:
+			res = isFalsey(l) ? r : l;
+			return true;
+		case Token::Type::TOKEN_EQUAL_EQUAL:
+		case Token::Type::TOKEN_BANG_EQUAL:
+			// the objects may define the operators
+			if(l.isGcObject() || r.isGcObject())
+				return false;
+			res = Value((l == r) ==
+			            (bin->token.type == Token::Type::TOKEN_EQUAL_EQUAL));
+			return true;
+		default: break;
+	}
+	if(l.isString() && r.isString() &&
+	   bin->token.type == Token::Type::TOKEN_PLUS) {
+		res = String::append(ls, rs);
+		return true;
+	}
+	if(!l.isNumber() || !r.isNumber())
+		return false;
+	double a = l.toNumber(), b = r.toNumber();
+	switch(bin->token.type) {
+		case Token::Type::TOKEN_PLUS: res.setNumber(a + b); return true;
+		case Token::Type::TOKEN_MINUS: res.setNumber(a - b); return true;
+		case Token::Type::TOKEN_STAR: res.setNumber(a * b); return true;
+		case Token::Type::TOKEN_SLASH: res.setNumber(a / b); return true;
+		case Token::Type::TOKEN_LESS: res = Value(a < b); return true;
+		case Token::Type::TOKEN_LESS_EQUAL: res = Value(a <= b); return true;
+		case Token::Type::TOKEN_GREATER: res = Value(a > b); return true;
+		case Token::Type::TOKEN_GREATER_EQUAL: res = Value(a >= b); return true;
+		default: break;
+	}
+	if(!l.isInteger() || !r.isInteger())
+		return false;
+	int64_t x = l.toInteger(), y = r.toInteger();
+	switch(bin->token.type) {
+		case Token::Type::TOKEN_AMPERSAND: res.setInteger(x & y); return true;
+		case Token::Type::TOKEN_PIPE: res.setInteger(x | y); return true;
+		case Token::Type::TOKEN_CARET: res.setInteger(x ^ y); return true;
+		// the shifts which are out of range are left to the
+		// engine
+		case Token::Type::TOKEN_LESS_LESS:
+			if(y < 0 || y > 63)
+				return false;
+			res.setInteger(x << y);
+			return true;
+		case Token::Type::TOKEN_GREATER_GREATER:
+			if(y < 0 || y > 63)
+				return false;
+			res.setInteger(x >> y);
+			return true;
+		default: return false;
+	}
+}
+
+void CodeGenerator::emitConstant(const Token &t, Value v) {
+	btx->insert_token(t);
+	// use explicit opcode for nil, since call optimizations
+	// pushes ValueNil in the preallocated local slots in
+	// the bytecode.
+	if(v.isNil())
+		btx->pushn();
+	else
+		btx->push(v);
+}
+
+CodeGenerator::CodeMark CodeGenerator::markCode() {
+	return CodeMark{btx->getip(), btx->code->stackSize,
+	                ftx->f->numExceptions, pendingBreaks.size};
+}
+
+bool CodeGenerator::discardCode(const CodeMark &m) {
+	// the catch blocks refer to the ips of their try blocks
+	if(ftx->f->numExceptions != m.numExceptions)
+		return false;
+	btx->discard(m.ip);
+	btx->code->stackSize = m.stackSize;
+	while(pendingBreaks.size > m.numBreaks) pendingBreaks.popLast();
+	return true;
+}
+
+void CodeGenerator::compileUnreachable(Statement *s) {
+	CodeMark m = markCode();
+	// the code is jumped over if it cannot be dropped
+	size_t skip = btx->jump(0);
+	s->accept(this);
+	if(!discardCode(m))
+		btx->jump(skip, btx->getip() - skip);
+}
+
+void CodeGenerator::compileUnreachable(Expression *e) {
+	CodeMark m    = markCode();
+	size_t   skip = btx->jump(0);
+	e->accept(this);
+	if(!discardCode(m)) {
+		// the value is never pushed
+		btx->stackEffect(-1);
+		btx->jump(skip, btx->getip() - skip);
+	}
+}
+
 void CodeGenerator::visit(BinaryExpression *bin) {
 #ifdef DEBUG_CODEGEN
 	dinfo("");
 	bin->token.highlight();
 #endif
+	Value v;
+	if(constantValue(bin, v)) {
+		emitConstant(bin->token, v);
+		return;
+	}
+	if(emitRegisterBinary(bin))
+		return;
+	if(fold &&
+	   (bin->token.type == Token::Type::TOKEN_and ||
+	    bin->token.type == Token::Type::TOKEN_or) &&
+	   constantValue(bin->left, v)) {
+		// either the right operand is never evaluated, or it
+		// is the result
+		if(isFalsey(v) == (bin->token.type == Token::Type::TOKEN_and)) {
+			emitConstant(bin->left->token, v);
+			compileUnreachable(bin->right);
+		} else
+			bin->right->accept(this);
+		return;
+	}
 	bin->left->accept(this);
 	int jumpto = -1;
 	switch(bin->token.type) {
@@ -351,6 +632,9 @@ void CodeGenerator::emitCall(CallExpression *call) {
 	} else if(!onRefer) { // if this is a method call, we
 		                  // don't need to resolve anything
 		info = resolveCall(name, signature);
+		if(!info.soft && (info.type == CLASS || info.type == MODULE) &&
+		   emitInline(call, info, signature))
+			return;
 		if(!info.soft) {
 			// not undefined, and not a soft call
 			// so load the receiver first
@@ -470,6 +754,184 @@ void CodeGenerator::emitCall(CallExpression *call) {
 	}
 }
 
+// returns the index of the parameter 'name' of the function,
+// -1 if there is none
+static int paramIndex(FnBodyStatement *body, const String2 &name) {
+	for(int i = 0; i < body->args->size; i++) {
+		if(body->args->values[i] == Value(name))
+			return i;
+	}
+	return -1;
+}
+
+int CodeGenerator::inlineCost(Expression *e, FnBodyStatement *body,
+                              InlineNames names) {
+	int cost = 1;
+	switch(e->type) {
+		case Expression::EXPR_Literal: return 1;
+		case Expression::EXPR_Variable: {
+			if(names == INLINE_ANY)
+				return 1;
+			if(e->token.type == Token::Type::TOKEN_this)
+				return names == INLINE_MEMBERS ? 1 : -1;
+			String2 name = String::from(e->token.start, e->token.length);
+			if(paramIndex(body, name) != -1 ||
+			   (names == INLINE_MEMBERS && ctx->has_mem(name)))
+				return 1;
+			return -1;
+		}
+		case Expression::EXPR_Assign: {
+			AssignExpression *as = e->toAssignExpression();
+			if(!as->target->isVariableExpression() ||
+			   as->target->token.type == Token::Type::TOKEN_this)
+				return -1;
+			cost = inlineCost(as->target, body, names);
+			e    = as->val;
+			break;
+		}
+		case Expression::EXPR_Binary: {
+			BinaryExpression *bin = e->toBinaryExpression();
+			cost = inlineCost(bin->left, body, names);
+			e    = bin->right;
+			break;
+		}
+		case Expression::EXPR_Prefix: e = e->toPrefixExpression()->right; break;
+		case Expression::EXPR_Postfix: e = e->toPostfixExpression()->left; break;
+		case Expression::EXPR_Grouping: {
+			Array *exprs = e->toGroupingExpression()->exprs;
+			for(int i = 0; i < exprs->size && cost != -1; i++) {
+				int c = inlineCost(exprs->values[i].toExpression(), body, names);
+				cost  = c == -1 ? -1 : cost + c;
+			}
+			return cost;
+		}
+		case Expression::EXPR_Get: {
+			// the member is resolved at runtime, but it must
+			// not be a method call
+			GetExpression *get = e->toGetExpression();
+			if(!get->refer->isVariableExpression())
+				return -1;
+			e = get->object;
+			break;
+		}
+		case Expression::EXPR_GetThisOrSuper: {
+			GetThisOrSuperExpression *get = e->toGetThisOrSuperExpression();
+			if(get->token.type != Token::Type::TOKEN_this ||
+			   !get->refer->isVariableExpression())
+				return -1;
+			return names != INLINE_PARAMS ? 2 : -1;
+		}
+		case Expression::EXPR_Set: {
+			SetExpression *set = e->toSetExpression();
+			cost = inlineCost(set->object, body, names);
+			e    = set->value;
+			break;
+		}
+		case Expression::EXPR_Subscript: {
+			SubscriptExpression *sub = e->toSubscriptExpression();
+			cost = inlineCost(sub->object, body, names);
+			e    = sub->idx;
+			break;
+		}
+		// calls, and the literals of the containers
+		default: return -1;
+	}
+	int c = inlineCost(e, body, names);
+	return cost == -1 || c == -1 ? -1 : cost + c + 1;
+}
+
+int CodeGenerator::inlineCost(FnBodyStatement *body, InlineNames names) {
+	if(body->isva || body->body == nullptr ||
+	   !body->body->isBlockStatement())
+		return -1;
+	Array *stmts = body->body->toBlockStatement()->statements;
+	int    cost  = 1;
+	for(int i = 0; stmts != nullptr && i < stmts->size; i++) {
+		Statement *s = stmts->values[i].toStatement();
+		if(s->isExpressionStatement()) {
+			Array *exprs = s->toExpressionStatement()->exprs;
+			for(int j = 0; j < exprs->size; j++) {
+				int c = inlineCost(exprs->values[j].toExpression(), body, names);
+				if(c == -1)
+					return -1;
+				cost += c;
+			}
+		} else if(s->isReturnStatement() && i == stmts->size - 1) {
+			Expression *e = s->toReturnStatement()->expr;
+			int         c = e == nullptr ? 0 : inlineCost(e, body, names);
+			if(c == -1)
+				return -1;
+			cost += c;
+		} else {
+			return -1;
+		}
+	}
+	return cost <= InlineMaxCost ? cost : -1;
+}
+
+bool CodeGenerator::emitInline(CallExpression *call, const CallInfo &info,
+                               const String2 &signature) {
+	ClassCompilationContext *c = info.type == CLASS ? ctx : mtx;
+	// a non static function called from a static one is
+	// reported by the usual path
+	if(!info.isStatic && ftx->get_fn()->isStatic())
+		return false;
+	FunctionCompilationContext *f = c->get_func_ctx(signature);
+	if(f->inlineBody == nullptr)
+		return false;
+	// the function has to be the one the call would find
+	// at runtime
+	if(c->get_class()->get_fn(info.frameIdx) != Value(f->get_fn()))
+		return false;
+	FnBodyStatement *body = f->inlineBody->toFnBodyStatement();
+	// the members of a class are only visible to its own
+	// methods. the module members are declared as the body
+	// of the module is compiled, so they are not considered.
+	InlineNames names =
+	    info.type == CLASS && ctx != mtx ? INLINE_MEMBERS : INLINE_PARAMS;
+	if(inlineCost(body, names) == -1)
+		return false;
+
+	int argSize = call->arguments->size;
+	int first   = 0;
+	for(int i = 0; i < argSize; i++) {
+		int slot = createTempSlot();
+		if(i == 0)
+			first = slot;
+	}
+	for(int i = 0; i < argSize; i++) {
+		call->arguments->values[i].toExpression()->accept(this);
+		btx->store_slot_pop_n(first + i);
+	}
+	btx->insert_token(call->callee->token);
+
+	FnBodyStatement *bakInlining = inlining;
+	int              bakSlot     = inlineSlot;
+	bool             bakNoPop    = expressionNoPop;
+	inlining                     = body;
+	inlineSlot                   = first;
+	expressionNoPop              = false;
+	Array *stmts = body->body->toBlockStatement()->statements;
+	bool   ret   = false;
+	for(int i = 0; stmts != nullptr && i < stmts->size; i++) {
+		Statement *s = stmts->values[i].toStatement();
+		if(s->isReturnStatement()) {
+			ret = s->toReturnStatement()->expr != nullptr;
+			if(ret)
+				s->toReturnStatement()->expr->accept(this);
+		} else {
+			s->accept(this);
+		}
+	}
+	// the function returns nil by default
+	if(!ret)
+		btx->pushn();
+	inlining        = bakInlining;
+	inlineSlot      = bakSlot;
+	expressionNoPop = bakNoPop;
+	return true;
+}
+
 void CodeGenerator::visit(CallExpression *call) {
 	emitCall(call);
 }
@@ -480,8 +942,15 @@ CodeGenerator::VarInfo CodeGenerator::lookForVariable2(String *   name,
                                                        bool       force) {
 	int slot = 0;
 	if(!force) {
+		int param = inlining ? paramIndex(inlining, name) : -1;
+		// the parameters of an inlined function are stored in
+		// the temporary slots, and the locals of the caller are
+		// not visible to it
+		if(param != -1) {
+			return VarInfo{inlineSlot + param, LOCAL, false};
+		}
 		// first check the present context
-		if(ftx->has_slot(name, scopeID)) {
+		if(inlining == nullptr && ftx->has_slot(name, scopeID)) {
 			slot = ftx->get_slot(name);
 			return VarInfo{slot, LOCAL, false};
 		} else { // It's in an enclosing class, or parent frame or another mtx
@@ -631,14 +1100,7 @@ void CodeGenerator::visit(LiteralExpression *lit) {
 	dinfo("");
 	lit->token.highlight();
 #endif
-	btx->insert_token(lit->token);
-	// use explicit opcode for nil, since call optimizations
-	// pushes ValueNil in the preallocated local slots in
-	// the bytecode.
-	if(lit->value.isNil())
-		btx->pushn();
-	else
-		btx->push(lit->value);
+	emitConstant(lit->token, lit->value);
 }
 
 void CodeGenerator::visit(SetExpression *sete) {
@@ -787,6 +1249,11 @@ void CodeGenerator::visit(PrefixExpression *pe) {
 	dinfo("");
 	pe->token.highlight();
 #endif
+	Value v;
+	if(constantValue(pe, v)) {
+		emitConstant(pe->token, v);
+		return;
+	}
 	switch(pe->token.type) {
 		case Token::Type::TOKEN_PLUS: pe->right->accept(this); break;
 		case Token::Type::TOKEN_BANG:
@@ -991,9 +1458,23 @@ void CodeGenerator::visit(IfStatement *ifs) {
 	dinfo("");
 	ifs->token.highlight();
 #endif
+	Value cond;
+	if(fold && constantValue(ifs->condition, cond)) {
+		// only one of the branches is ever taken
+		if(isFalsey(cond)) {
+			compileUnreachable(ifs->thenBlock);
+			if(ifs->elseBlock != nullptr)
+				ifs->elseBlock->accept(this);
+		} else {
+			ifs->thenBlock->accept(this);
+			if(ifs->elseBlock != nullptr)
+				compileUnreachable(ifs->elseBlock);
+		}
+		return;
+	}
 	ifs->condition->accept(this);
 	btx->insert_token(ifs->token);
-	int jif = btx->jumpiffalse(0), jumpto = 0, exitif = -1;
+	int jif = btx->jumpiffalse_(0), jumpto = 0, exitif = -1;
 	ifs->thenBlock->accept(this);
 	if(ifs->elseBlock != nullptr) {
 		exitif = btx->jump(0);
@@ -1015,11 +1496,23 @@ void CodeGenerator::visit(WhileStatement *ifs) {
 	ifs->token.highlight();
 #endif
 	inLoop++;
-	if(!ifs->isDo) {
+	Value cond;
+	if(fold && constantValue(ifs->condition, cond)) {
+		// the loop is either never entered, or only exited
+		// by a break or a ret
+		if(!ifs->isDo && isFalsey(cond))
+			compileUnreachable(ifs->thenBlock);
+		else {
+			int pos = btx->getip();
+			ifs->thenBlock->accept(this);
+			if(!isFalsey(cond))
+				btx->jump(pos - btx->getip());
+		}
+	} else if(!ifs->isDo) {
 		int pos = btx->getip();
 		ifs->condition->accept(this);
 		btx->insert_token(ifs->token);
-		int loopexit = btx->jumpiffalse(0);
+		int loopexit = btx->jumpiffalse_(0);
 		ifs->thenBlock->accept(this);
 		btx->jump(pos - btx->getip());
 		btx->jumpiffalse(loopexit, btx->getip() - loopexit);
@@ -1126,7 +1619,7 @@ void CodeGenerator::visit(ForStatement *ifs) {
 		if(ifs->cond != NULL) {
 			ifs->cond->accept(this);
 			// exit if the condition is violated
-			patch_exit = btx->jumpiffalse(0);
+			patch_exit = btx->jumpiffalse_(0);
 		}
 		// evalute the body
 		ifs->body->accept(this);
@@ -1250,6 +1743,11 @@ void CodeGenerator::visit(FnStatement *ifs) {
 		FunctionCompilationContext2 fctx = FunctionCompilationContext::create(
 		    String::from(ifs->name.start, ifs->name.length), ifs->arity,
 		    ifs->isStatic, ifs->body->isva);
+		// the names are validated at the call site, once all
+		// the members are declared
+		if(!inConstructor && !ifs->isNative &&
+		   inlineCost(ifs->body, INLINE_ANY) != -1)
+			fctx->inlineBody = ifs->body;
 		Visibility consider = currentVisibility;
 		// if we're at module level, don't consider the global visibility
 		if(ctx == mtx || ifs->visibility != VIS_DEFAULT)
@@ -1333,8 +1831,16 @@ void CodeGenerator::visit(BlockStatement *ifs) {
 	pushScope();
 	// Back up the previous stack specifications
 	int present = btx->code->stackSize;
-	for(int j = 0; j < ifs->statements->size; j++)
-		ifs->statements->values[j].toStatement()->accept(this);
+	for(int j = 0; j < ifs->statements->size; j++) {
+		Statement *s = ifs->statements->values[j].toStatement();
+		s->accept(this);
+		// the rest of the block is never executed
+		if(fold && (s->isReturnStatement() || s->isThrowStatement() ||
+		            s->isBreakStatement())) {
+			while(++j < ifs->statements->size)
+				compileUnreachable(ifs->statements->values[j].toStatement());
+		}
+	}
 	// we keep the largest size as present
 	if(present > btx->code->stackSize)
 		btx->code->stackSize = present;
@@ -1347,7 +1853,11 @@ void CodeGenerator::visit(ExpressionStatement *ifs) {
 	ifs->token.highlight();
 #endif
 	for(int j = 0; j < ifs->exprs->size; j++) {
-		ifs->exprs->values[j].toExpression()->accept(this);
+		Expression *e = ifs->exprs->values[j].toExpression();
+		// the result is not pushed in this case
+		if(!expressionNoPop && emitRegisterAssign(e))
+			continue;
+		e->accept(this);
 		// An expression should always return a value.
 		// Pop the value to minimize the stack length
 		if(!expressionNoPop)
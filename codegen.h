@@ -155,6 +155,81 @@ class CodeGenerator : public StatementVisitor, public ExpressionVisitor {
 	CompilationState getState();
 	int              createTempSlot();
 
+	// register opcodes
+	// ----------------
+	// arithmetic and comparisons whose right operand is a
+	// local variable or a number constant are compiled to the
+	// register forms of the opcodes, which read the slots
+	// and the constants directly.
+	// returns the slot of the expression, if it is a
+	// local variable, -1 otherwise
+	int localSlot(Expression *e);
+	// emits the register form of the binary expression, if
+	// it qualifies, and returns true. if 'dest' is not -1,
+	// the result is stored to that slot instead of being
+	// pushed, which needs both the operands to be locals.
+	bool emitRegisterBinary(BinaryExpression *bin, int dest = -1);
+	// compiles 'a = b <op> c' to a single opcode, when all
+	// of them are local variables. the result is not pushed.
+	bool emitRegisterAssign(Expression *e);
+
+	// inlining
+	// --------
+	// a call which is resolved to a function at compile time
+	// is replaced by the body of the function, if the body
+	// only consists of expression statements followed by an
+	// optional return, and does not call, throw or declare
+	// anything. the arguments are stored in temporary slots.
+	static const int InlineMaxCost = 24;
+	// the names a body can refer to, other than its parameters
+	enum InlineNames {
+		INLINE_ANY,    // not checked, only the shape is validated
+		INLINE_PARAMS, // none
+		INLINE_MEMBERS // the members of the present class, and 'this'
+	};
+	// returns the number of nodes in the body, or in the
+	// expression, if it can be inlined, -1 otherwise
+	int inlineCost(FnBodyStatement *body, InlineNames names);
+	int inlineCost(Expression *e, FnBodyStatement *body, InlineNames names);
+	// emits the body of the function the call is resolved
+	// to, and returns true, if it can be inlined
+	bool emitInline(CallExpression *call, const CallInfo &info,
+	                const String2 &signature);
+	// the function which is being inlined, and the slot of
+	// its first argument
+	FnBodyStatement *inlining;
+	int              inlineSlot;
+
+	// constant folding
+	// ----------------
+	// the operators whose operands are all constants are
+	// evaluated at compile time, with the semantics of the
+	// engine, and the code which can never be executed, i.e.
+	// the statements following a ret, throw or break in a
+	// block, and the branches of a constant condition which
+	// are never taken, is dropped. it is still compiled, so
+	// that its declarations and errors are not lost. both are
+	// disabled if NEXT_NO_FOLD is set in the environment.
+	bool fold;
+	// stores the value of the expression in 'res', and returns
+	// true, if it is a constant. only the literals are
+	// constants if folding is disabled.
+	bool constantValue(Expression *e, Value &res);
+	void emitConstant(const Token &t, Value v);
+	// the state of the function at a point of the code
+	struct CodeMark {
+		size_t ip;
+		int    stackSize;
+		size_t numExceptions;
+		size_t numBreaks;
+	};
+	CodeMark markCode();
+	// drops the code generated since the mark, and returns
+	// true, if it can be dropped
+	bool discardCode(const CodeMark &m);
+	void compileUnreachable(Statement *s);
+	void compileUnreachable(Expression *e);
+
 	int  pushScope();
 	void popScope(); // discard all variables in present frame with
 	                 // scopeID >= present scope
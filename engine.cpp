@@ -12,6 +12,14 @@
 #include "objects/symtab.h"
 #include "printer.h"
 
+#ifdef NEXT_PROFILE_OPCODES
+#include <cstdio>
+#include <cstdlib>
+#include <unordered_map>
+// every dispatch has to go through the top of the loop
+#undef NEXT_USE_COMPUTED_GOTO
+#endif
+
 ExecutionEngine::ModuleMap *ExecutionEngine::loadedModules         = nullptr;
 Array *                     ExecutionEngine::pendingExceptions     = nullptr;
 Array *                     ExecutionEngine::pendingFibers         = nullptr;
@@ -20,8 +28,86 @@ Object *                    ExecutionEngine::CoreObject            = nullptr;
 size_t                      ExecutionEngine::maxRecursionLimit     = 1024;
 size_t                      ExecutionEngine::currentRecursionDepth = 0;
 bool                        ExecutionEngine::isRunningRepl         = false;
+ExecutionEngine::MethodCacheEntry
+    ExecutionEngine::methodCache[ExecutionEngine::MethodCacheSize] = {};
+
+#ifdef NEXT_PROFILE_OPCODES
+// opcode profiling
+// ----------------
+// counts the executed opcodes, along with the pairs and the
+// triples of them executed one after another, and writes them
+// to the file named by NEXT_OPCODE_PROFILE on exit, one per
+// line, as '<count> <opcode>...'. util/opcode_ngrams.py runs
+// the benchmarks with it, and sums them up.
+static const size_t numOpcodes = 0
+#define OPCODE0(x, y) +1
+#define OPCODE1(x, y, z) +1
+#define OPCODE2(w, x, y, z) +1
+#include "opcodes.h"
+    ;
+static size_t opcodeCounts[numOpcodes] = {0};
+
+// indexed by first * numOpcodes + second
+static size_t opcodePairs[numOpcodes * numOpcodes] = {0};
+
+// indexed likewise, there are too many of them for an array
+static std::unordered_map<size_t, size_t> opcodeTriples;
+
+// last two executed opcodes
+static size_t previousOpcodes[2] = {numOpcodes, numOpcodes};
+
+static void profileOpcode(size_t op) {
+	size_t a = previousOpcodes[0], b = previousOpcodes[1];
+	opcodeCounts[op]++;
+	if(b < numOpcodes) {
+		opcodePairs[b * numOpcodes + op]++;
+		if(a < numOpcodes)
+			opcodeTriples[(a * numOpcodes + b) * numOpcodes + op]++;
+	}
+	previousOpcodes[0] = b;
+	previousOpcodes[1] = op;
+}
+
+// file to write the profile to
+static const char *profilePath = nullptr;
+
+static void dumpOpcodeProfile() {
+	FILE *f = std::fopen(profilePath, "w");
+	if(f == nullptr) {
+		Printer::Err("Unable to open '", profilePath,
+		             "' to write the opcode profile!");
+		return;
+	}
+	const char **names = Bytecode::OpcodeNames;
+	for(size_t i = 0; i < numOpcodes; i++)
+		if(opcodeCounts[i])
+			std::fprintf(f, "%zu %s\n", opcodeCounts[i], names[i]);
+	for(size_t i = 0; i < numOpcodes * numOpcodes; i++)
+		if(opcodePairs[i])
+			std::fprintf(f, "%zu %s %s\n", opcodePairs[i],
+			             names[i / numOpcodes], names[i % numOpcodes]);
+	for(auto &t : opcodeTriples)
+		std::fprintf(f, "%zu %s %s %s\n", t.second,
+		             names[t.first / numOpcodes / numOpcodes],
+		             names[t.first / numOpcodes % numOpcodes],
+		             names[t.first % numOpcodes]);
+	std::fclose(f);
+}
+#endif
+
+bool ExecutionEngine::hasPendingExceptions() {
+	return pendingExceptions->size != 0;
+}
 
 void ExecutionEngine::init() {
+#ifdef NEXT_USE_JIT
+	Jit::init();
+#endif
+#ifdef NEXT_PROFILE_OPCODES
+	profilePath = std::getenv("NEXT_OPCODE_PROFILE");
+	if(profilePath != nullptr)
+		std::atexit(dumpOpcodeProfile);
+#endif
 	loadedModules = (ModuleMap *)Gc_malloc(sizeof(ModuleMap));
 	::new(loadedModules) ModuleMap();
 	pendingExceptions = Array::create(1);
@@ -135,14 +221,28 @@ void ExecutionEngine::mark() {
 	// mark the pending exceptions and fibers
 	Gc::mark(pendingExceptions);
 	Gc::mark(pendingFibers);
+	if(loadedModules) {
+		for(auto &a : *loadedModules) Gc::mark(a.first);
+	}
+	// the cached classes are kept alive, so that another class
+	// is never allocated at the same address while it is cached
+	for(auto &e : methodCache) {
+		if(e.klass != nullptr) {
+			Gc::mark((GcObject *)e.klass);
+			Gc::mark(e.function);
+		}
+	}
+}
+
+void ExecutionEngine::removeUnmarkedModules() {
 	// the modules which are not marked, remove them.
 	// we can't really remove the keys, i.e. paths,
 	// in the same time we traverse, so we keep those,
 	// and remove the modules themselves
 	if(loadedModules) {
 		for(auto &a : *loadedModules) {
-			Gc::mark(a.first);
-			if(a.second != NULL && !a.second->isMarked())
+			if(a.second != NULL && !a.second->isMarked() &&
+			   a.second->getGeneration() <= Gc::collectingGeneration)
 				loadedModules[0][a.first] = NULL;
 		}
 	}
@@ -382,6 +482,7 @@ bool ExecutionEngine::execute(Fiber *fiber, Value *returnValue) {
 	int numberOfExceptions = pendingExceptions->size;
 
 	int       numberOfArguments;
+	Value     leftOperand;
 	Value     rightOperand;
 	int       methodToCall;
 	Function *functionToCall;
@@ -391,6 +492,10 @@ bool ExecutionEngine::execute(Fiber *fiber, Value *returnValue) {
 	Value *           Stack              = presentFrame->stack_;
 	Value *           Locals             = presentFrame->locals;
 	Bytecode::Opcode *CallPatch          = nullptr;
+#ifdef NEXT_USE_JIT
+	// the dispatch table in use, see jitTable
+	const void *const *table;
+#endif
 
 #define GOTOERROR() \
 	{ goto error; }
@@ -421,15 +526,30 @@ bool ExecutionEngine::execute(Fiber *fiber, Value *returnValue) {
 #define OPCODE2(w, x, y, z) OPCODE0(w, x)
 #include "opcodes.h"
 	    &&DEFAULT()};
+#ifdef NEXT_USE_JIT
+	// while the engine dispatches through this table, it tries to
+	// enter the compiled code of the present frame before every
+	// instruction, see jitenter
+	static const void *jitTable[] = {
+#define OPCODE0(x, y) &&jitenter,
+#define OPCODE1(x, y, z) OPCODE0(x, y)
+#define OPCODE2(w, x, y, z) OPCODE0(w, x)
+#include "opcodes.h"
+	    &&jitenter};
+	table = dispatchTable;
+#define DISPATCH_TABLE table
+#else
+#define DISPATCH_TABLE dispatchTable
+#endif
 
 #define LOOP() while(1)
 #define SWITCH() \
-	{ goto *dispatchTable[*InstructionPointer]; }
+	{ goto *DISPATCH_TABLE[*InstructionPointer]; }
 #define CASE(x) EXEC_CODE_##x
 #define DISPATCH() \
-	{ goto *dispatchTable[*(++InstructionPointer)]; }
+	{ goto *DISPATCH_TABLE[*(++InstructionPointer)]; }
 #define DISPATCH_WINC() \
-	{ goto *dispatchTable[*InstructionPointer]; }
+	{ goto *DISPATCH_TABLE[*InstructionPointer]; }
 #else
 #define LOOP() while(1)
 #define SWITCH() switch(*InstructionPointer)
@@ -456,6 +576,19 @@ bool ExecutionEngine::execute(Fiber *fiber, Value *returnValue) {
 #define JUMPTO_OFFSET(x) \
 	{ JUMPTO((x) - (sizeof(int) / sizeof(Bytecode::Opcode))); }
 
+#ifdef NEXT_USE_JIT
+	// a backward jump counts as an entry to the bytecode, so that
+	// long running loops are compiled too
+#define JIT_BACKEDGE(x)                                          \
+	if((x) < 0 && Jit::hot(presentFrame->f->code)) {             \
+		InstructionPointer +=                                    \
+		    (x) - (sizeof(int) / sizeof(Bytecode::Opcode));      \
+		goto jitenter;                                           \
+	}
+#else
+#define JIT_BACKEDGE(x)
+#endif
+
 #define RESTORE_FRAMEINFO()                        \
 	presentFrame       = fiber->getCurrentFrame(); \
 	InstructionPointer = presentFrame->code;       \
@@ -484,6 +617,195 @@ bool ExecutionEngine::execute(Fiber *fiber, Value *returnValue) {
 		}                                                                  \
 	}
 
+	// keeps the double path of the arithmetic below inline,
+	// ahead of the path for the mixed operands
+#ifdef __GNUC__
+#define expect_doubles(x) __builtin_expect(!!(x), 1)
+#else
+#define expect_doubles(x) (x)
+#endif
+
+	// perform 'left op right' on two small integers, and store
+	// it in 'dest'. the shifted integers keep their tags, see
+	// value.h.
+#define shifted_integers(dest, left, op, right)           \
+	(dest).setShiftedInteger((left).toShiftedInteger() op \
+	                         (right).toShiftedInteger())
+#define compared_integers(dest, left, op, right) \
+	(dest).setBoolean((left).toShiftedInteger() op(right).toShiftedInteger())
+#define multiplied_integers(dest, left, op, right) \
+	(dest).setProduct((left).toSmallInteger(), (right).toSmallInteger())
+#define divided_integers(dest, left, op, right)        \
+	(dest).setNumber((double)(left).toSmallInteger() / \
+	                 (double)(right).toSmallInteger())
+
+	// performs 'left op right', and stores it in 'dest', if both
+	// of the operands are numbers. evaluates to false if the
+	// operands are not numbers.
+#define numeric(dest, left, op, right, restype, integers)                   \
+	(Value::areSmallIntegers(left, right)                                   \
+	     ? (integers(dest, left, op, right), true)                          \
+	     : expect_doubles(Value::areDoubles(left, right))                   \
+	           ? ((dest).set##restype((left).toDouble() op                  \
+	                                  (right).toDouble()),                  \
+	              true)                                                     \
+	           : ((left).isNumber() && (right).isNumber()                   \
+	                  ? ((dest).set##restype((left).toNumber() op           \
+	                                         (right).toNumber()),           \
+	                     true)                                              \
+	                  : false))
+
+	// stores the result of the comparison in 'cond' instead
+#define numeric_compare(cond, left, op, right)                              \
+	(Value::areSmallIntegers(left, right)                                   \
+	     ? ((cond) = (left).toShiftedInteger() op                           \
+	                 (right).toShiftedInteger(),                            \
+	        true)                                                           \
+	     : expect_doubles(Value::areDoubles(left, right))                   \
+	           ? ((cond) = (left).toDouble() op (right).toDouble(), true)   \
+	           : ((left).isNumber() && (right).isNumber()                   \
+	                  ? ((cond) = (left).toNumber() op (right).toNumber(),  \
+	                     true)                                              \
+	                  : false))
+
+	// register forms of the binary operators, see opcodes.h
+#define register_binary(opcode, op, restype, integers)                      \
+	CASE(opcode##_ss) : {                                                   \
+		leftOperand  = Stack[next_int()];                                   \
+		rightOperand = Stack[next_int()];                                   \
+		PUSH(leftOperand);                                                  \
+		if(numeric(TOP, leftOperand, op, rightOperand, restype, integers))  \
+			DISPATCH();                                                     \
+		PUSH(rightOperand);                                                 \
+		methodToCall      = SymbolTable2::const_sig_##opcode;               \
+		numberOfArguments = 1;                                              \
+		goto methodcall;                                                    \
+	}                                                                       \
+	CASE(opcode##_ts) : {                                                   \
+		rightOperand = Stack[next_int()];                                   \
+		if(numeric(TOP, TOP, op, rightOperand, restype, integers))          \
+			DISPATCH();                                                     \
+		PUSH(rightOperand);                                                 \
+		methodToCall      = SymbolTable2::const_sig_##opcode;               \
+		numberOfArguments = 1;                                              \
+		goto methodcall;                                                    \
+	}                                                                       \
+	CASE(opcode##_sss) : {                                                  \
+		leftOperand  = Stack[next_int()];                                   \
+		rightOperand = Stack[next_int()];                                   \
+		/* perform the following store_slot_pop by ourselves */             \
+		if(numeric(Stack[InstructionPointer[2]], leftOperand, op,           \
+		           rightOperand, restype, integers)) {                      \
+			InstructionPointer += 2;                                        \
+			DISPATCH();                                                     \
+		}                                                                   \
+		/* the method returns to the store */                               \
+		PUSH(leftOperand);                                                  \
+		PUSH(rightOperand);                                                 \
+		methodToCall      = SymbolTable2::const_sig_##opcode;               \
+		numberOfArguments = 1;                                              \
+		goto methodcall;                                                    \
+	}                                                                       \
+	CASE(opcode##_tc) : {                                                   \
+		/* the constant is always a number */                               \
+		rightOperand = next_value();                                        \
+		if(numeric(TOP, TOP, op, rightOperand, restype, integers))          \
+			DISPATCH();                                                     \
+		PUSH(rightOperand);                                                 \
+		methodToCall      = SymbolTable2::const_sig_##opcode;               \
+		numberOfArguments = 1;                                              \
+		goto methodcall;                                                    \
+	}                                                                       \
+	CASE(opcode##_sc) : {                                                   \
+		leftOperand  = Stack[next_int()];                                   \
+		rightOperand = next_value();                                        \
+		PUSH(leftOperand);                                                  \
+		if(numeric(TOP, leftOperand, op, rightOperand, restype, integers))  \
+			DISPATCH();                                                     \
+		PUSH(rightOperand);                                                 \
+		methodToCall      = SymbolTable2::const_sig_##opcode;               \
+		numberOfArguments = 1;                                              \
+		goto methodcall;                                                    \
+	}
+
+	// fused comparison and jumpiffalse, see opcodes.h. the
+	// operands are fetched by the given statements.
+#define compare_jump(name, opcode, op, ...)                                 \
+	CASE(name) : {                                                          \
+		__VA_ARGS__;                                                        \
+		bool holds;                                                         \
+		if(numeric_compare(holds, leftOperand, op, rightOperand)) {         \
+			/* perform the following jumpiffalse by ourselves */            \
+			if(!holds)                                                      \
+				JUMPTO(InstructionPointer[2] + 1);                          \
+			InstructionPointer += 2;                                        \
+			DISPATCH();                                                     \
+		}                                                                   \
+		/* the method returns to the jump */                                \
+		PUSH(leftOperand);                                                  \
+		PUSH(rightOperand);                                                 \
+		methodToCall      = SymbolTable2::const_sig_##opcode;               \
+		numberOfArguments = 1;                                              \
+		goto methodcall;                                                    \
+	}
+
+#define register_compare_jump(opcode, op)                                   \
+	compare_jump(opcode##_jumpiffalse, opcode, op, rightOperand = POP();    \
+	             leftOperand = POP());                                      \
+	compare_jump(opcode##_ts_jumpiffalse, opcode, op, leftOperand = POP();  \
+	             rightOperand = Stack[next_int()]);                         \
+	compare_jump(opcode##_ss_jumpiffalse, opcode, op,                       \
+	             leftOperand  = Stack[next_int()];                          \
+	             rightOperand = Stack[next_int()]);                         \
+	compare_jump(opcode##_tc_jumpiffalse, opcode, op, leftOperand = POP();  \
+	             rightOperand = next_value());                              \
+	compare_jump(opcode##_sc_jumpiffalse, opcode, op,                       \
+	             leftOperand  = Stack[next_int()];                          \
+	             rightOperand = next_value());
+
+	// stack forms of the operators, which rewrite themselves
+	// to their quickened forms after looking at the operands,
+	// see opcodes.h. the statements in the varargs can quicken
+	// the operator for other types.
+#define quickened_binary(opcode, op, restype, integers, ...)                \
+	CASE(opcode) : {                                                        \
+		rightOperand = POP();                                               \
+		if(rightOperand.isSmallInteger() && TOP.isSmallInteger()) {         \
+			*InstructionPointer = Bytecode::CODE_##opcode##_int_int;        \
+			integers(TOP, TOP, op, rightOperand);                           \
+			DISPATCH();                                                     \
+		}                                                                   \
+		if(rightOperand.isNumber() && TOP.isNumber()) {                     \
+			*InstructionPointer = Bytecode::CODE_##opcode##_num_num;        \
+			TOP.set##restype(TOP.toNumber() op rightOperand.toNumber());    \
+			DISPATCH();                                                     \
+		}                                                                   \
+		__VA_ARGS__;                                                        \
+		PUSH(rightOperand);                                                 \
+		methodToCall      = SymbolTable2::const_sig_##opcode;               \
+		numberOfArguments = 1;                                              \
+		goto methodcall;                                                    \
+	}                                                                       \
+	quickened_guard(opcode, opcode##_int_int, SmallInteger,                 \
+	                integers(TOP, TOP, op, rightOperand));                  \
+	quickened_guard(opcode, opcode##_num_num, Number,                       \
+	                numeric(TOP, TOP, op, rightOperand, restype, integers))
+
+	// performs the operation if both of the operands are of
+	// the given type. otherwise, rewrites the opcode back to
+	// the operator, which runs again on the same operands.
+#define quickened_guard(opcode, name, type, ...)                            \
+	CASE(name) : {                                                          \
+		rightOperand = POP();                                               \
+		if(rightOperand.is##type() && TOP.is##type()) {                     \
+			__VA_ARGS__;                                                    \
+			DISPATCH();                                                     \
+		}                                                                   \
+		*InstructionPointer = Bytecode::CODE_##opcode;                      \
+		PUSH(rightOperand);                                                 \
+		DISPATCH_WINC();                                                    \
+	}
+
 #define binary_perform_direct(op, a, b) ((a)op(b))
 #define binary(op, opname, argtype, restype, opcode) \
 	binary_multiway(op, opname, argtype, restype, opcode, binary_perform_direct)
@@ -571,7 +893,14 @@ bool ExecutionEngine::execute(Fiber *fiber, Value *returnValue) {
 		PUSH(res);
 	}
 
+#ifdef NEXT_USE_JIT
+	if(Jit::hot(presentFrame->f->code))
+		goto jitenter;
+#endif
 	LOOP() {
+#ifdef NEXT_PROFILE_OPCODES
+		profileOpcode(*InstructionPointer);
+#endif
 #ifdef DEBUG_INS
 		{
 			Printer::println();
@@ -609,27 +938,48 @@ bool ExecutionEngine::execute(Fiber *fiber, Value *returnValue) {
 		}
 #endif
 		SWITCH() {
-			CASE(add) : binary(+, addition, Number, Number, add);
-			CASE(sub) : binary(-, subtraction, Number, Number, sub);
-			CASE(mul) : binary(*, multiplication, Number, Number, mul);
-			CASE(div) : binary(/, division, Number, Number, div);
+			quickened_binary(
+			    add, +, Double, shifted_integers,
+			    if(rightOperand.isString() && TOP.isString()) {
+				    *InstructionPointer = Bytecode::CODE_add_str_str;
+				    TOP = String::append(TOP.toString(),
+				                         rightOperand.toString());
+				    DISPATCH();
+			    });
+			quickened_binary(sub, -, Double, shifted_integers);
+			quickened_binary(mul, *, Double, multiplied_integers);
+			quickened_binary(div, /, Double, divided_integers);
+			quickened_binary(greater, >, Boolean, compared_integers);
+			quickened_binary(greatereq, >=, Boolean, compared_integers);
+			quickened_binary(less, <, Boolean, compared_integers);
+			quickened_binary(lesseq, <=, Boolean, compared_integers);
+			quickened_guard(add, add_str_str, String,
+			                TOP = String::append(TOP.toString(),
+			                                     rightOperand.toString()));
 			CASE(lor) : binary_shortcircuit(!);
 			CASE(land) : binary_shortcircuit();
-			CASE(greater) : binary(>, greater than, Number, Boolean, greater);
-			CASE(greatereq)
-			    : binary(>=, greater than or equals to, Number, Boolean,
-			             greatereq);
-			CASE(less) : binary(<, lesser than, Number, Boolean, less);
-			CASE(lesseq)
-			    : binary(<=, lesser than or equals to, Number, Boolean, lesseq);
-
-			CASE(band) : binary(&, binary AND, Integer, Number, band);
-			CASE(bor) : binary(|, binary OR, Integer, Number, bor);
-			CASE(bxor) : binary(^, binary XOR, Integer, Number, bxor);
+
+			register_binary(add, +, Double, shifted_integers);
+			register_binary(sub, -, Double, shifted_integers);
+			register_binary(mul, *, Double, multiplied_integers);
+			register_binary(div, /, Double, divided_integers);
+			register_binary(less, <, Boolean, compared_integers);
+			register_binary(lesseq, <=, Boolean, compared_integers);
+			register_binary(greater, >, Boolean, compared_integers);
+			register_binary(greatereq, >=, Boolean, compared_integers);
+
+			register_compare_jump(less, <);
+			register_compare_jump(lesseq, <=);
+			register_compare_jump(greater, >);
+			register_compare_jump(greatereq, >=);
+
+			CASE(band) : binary(&, binary AND, Integer, Integer, band);
+			CASE(bor) : binary(|, binary OR, Integer, Integer, bor);
+			CASE(bxor) : binary(^, binary XOR, Integer, Integer, bxor);
 			CASE(blshift)
-			    : binary(<<, binary left shift, Integer, Number, blshift);
+			    : binary(<<, binary left shift, Integer, Integer, blshift);
 			CASE(brshift)
-			    : binary(>>, binary right shift, Integer, Number, brshift);
+			    : binary(>>, binary right shift, Integer, Integer, brshift);
 
 			CASE(neq) : {
 				rightOperand = POP();
@@ -714,7 +1064,7 @@ bool ExecutionEngine::execute(Fiber *fiber, Value *returnValue) {
 
 			CASE(bnot) : {
 				if(TOP.isInteger()) {
-					TOP.setNumber(~TOP.toInteger());
+					TOP.setInteger(~TOP.toInteger());
 					DISPATCH();
 				}
 				RERRF("'~' must only be applied over an integer!");
@@ -735,6 +1085,10 @@ bool ExecutionEngine::execute(Fiber *fiber, Value *returnValue) {
 			}
 
 			CASE(incr) : {
+				if(TOP.isSmallInteger()) {
+					TOP.setInteger(TOP.toSmallInteger() + 1);
+					DISPATCH();
+				}
 				if(TOP.isNumber()) {
 					TOP.setNumber(TOP.toNumber() + 1);
 					DISPATCH();
@@ -747,6 +1101,10 @@ bool ExecutionEngine::execute(Fiber *fiber, Value *returnValue) {
 			}
 
 			CASE(decr) : {
+				if(TOP.isSmallInteger()) {
+					TOP.setInteger(TOP.toSmallInteger() - 1);
+					DISPATCH();
+				}
 				if(TOP.isNumber()) {
 					TOP.setNumber(TOP.toNumber() - 1);
 					DISPATCH();
@@ -815,6 +1173,7 @@ bool ExecutionEngine::execute(Fiber *fiber, Value *returnValue) {
 
 			CASE(jump) : {
 				int offset = next_int();
+				JIT_BACKEDGE(offset);
 				JUMPTO_OFFSET(offset); // offset the relative jump address
 			}
 
@@ -861,6 +1220,7 @@ bool ExecutionEngine::execute(Fiber *fiber, Value *returnValue) {
 				int   dis = next_int();
 				bool  fl  = is_falsey(v);
 				if(!fl) {
+					JIT_BACKEDGE(dis);
 					JUMPTO_OFFSET(dis); // offset the relative jump address
 				}
 				DISPATCH();
@@ -979,6 +1339,7 @@ bool ExecutionEngine::execute(Fiber *fiber, Value *returnValue) {
 		numberOfArguments = next_int();                                   \
 		if(Locals[idxstart] == fiber->stackTop[-numberOfArguments - 1]) { \
 			functionToCall = Locals[idxstart + 1].toFunction();           \
+			Locals[idxstart + Bytecode::CallCacheHits].increment();       \
 			/* set the receiver to nil so that construct                  \
 			knows to create a new receiver */                             \
 			fiber->stackTop[-numberOfArguments - 1] = ValueNil;           \
@@ -1007,6 +1368,7 @@ bool ExecutionEngine::execute(Fiber *fiber, Value *returnValue) {
 		Function *   f = Locals[idxstart + 1].toFunction();           \
 		if(c == fiber->stackTop[-numberOfArguments - 1].getClass()) { \
 			functionToCall = f;                                       \
+			Locals[idxstart + Bytecode::CallCacheHits].increment();   \
 			/* ignore the next opcode */                              \
 			SKIPCALL();                                               \
 			/* directly jump to the appropriate call */               \
@@ -1021,6 +1383,46 @@ bool ExecutionEngine::execute(Fiber *fiber, Value *returnValue) {
 			CASE(call_fast_method) : { FASTCALL(method); }
 
 #undef FASTCALL
+
+#define POLYCALL()                                               \
+	{                                                            \
+		Locals[idxstart + Bytecode::CallCacheHits].increment();  \
+		SKIPCALL();                                              \
+		if(functionToCall->getType() == Function::Type::BUILTIN) \
+			goto performbuiltin;                                 \
+		goto performmethod;                                      \
+	}
+
+			CASE(call_fast_poly) : {
+				CallPatch         = InstructionPointer;
+				int idxstart      = next_int();
+				numberOfArguments = next_int();
+				const Class *c =
+				    fiber->stackTop[-numberOfArguments - 1].getClass();
+				// the empty pairs hold nil, which is never a class
+				for(int i = 0; i < Bytecode::CallCacheHits; i += 2) {
+					if(Locals[idxstart + i].toClass() == c) {
+						functionToCall = Locals[idxstart + i + 1].toFunction();
+						POLYCALL();
+					}
+				}
+				DISPATCH();
+			}
+
+			CASE(call_fast_mega) : {
+				CallPatch         = InstructionPointer;
+				int idxstart      = next_int();
+				numberOfArguments = next_int();
+				// the symbol of the call that follows
+				int sym        = *(InstructionPointer + 2);
+				functionToCall = ExecutionEngine::lookupMethod(
+				    fiber->stackTop[-numberOfArguments - 1].getClass(), sym);
+				if(functionToCall != nullptr)
+					POLYCALL();
+				DISPATCH();
+			}
+
+#undef POLYCALL
 #undef SKIPCALL
 
 		methodcall : {
@@ -1042,46 +1444,57 @@ bool ExecutionEngine::execute(Fiber *fiber, Value *returnValue) {
 			// also stores the class and the function in the locals
 			// array.
 			if(CallPatch) {
-				Bytecode::Opcode *bak = InstructionPointer;
-				InstructionPointer    = CallPatch;
-				// get the index
-				int idx = next_int();
-				// ignore numberOfArguments for now
-				next_int();
-				// get the next opcode
-				Bytecode::Opcode op = *++InstructionPointer;
+				// the cache starts at idx, and the call that follows
+				// has the symbol as its first operand
+				int              idx   = *(CallPatch + 1);
+				Bytecode::Opcode op    = *(CallPatch + 3);
+				int              sym   = *(CallPatch + 4);
+				Value *          cache = &Locals[idx];
+				cache[Bytecode::CallCacheMisses].increment();
+				bool builtin =
+				    functionToCall->getType() == Function::Type::BUILTIN;
 				// if we are performing a softcall, patch
 				// accordingly.
 				if(op == Bytecode::Opcode::CODE_call_soft) {
 					*CallPatch =
-					    functionToCall->getType() == Function::Type::BUILTIN
-					        ? Bytecode::Opcode::CODE_call_fast_builtin_soft
-					        : Bytecode::Opcode::CODE_call_fast_method_soft;
-				} else {
-					// we are performing a normal method call
-					*CallPatch =
-					    functionToCall->getType() == Function::Type::BUILTIN
-					        ? Bytecode::Opcode::CODE_call_fast_builtin
-					        : Bytecode::Opcode::CODE_call_fast_method;
-				}
-				// store the receiver's class in the locals array
-				if(op == Bytecode::Opcode::CODE_call_soft) {
-					Locals[idx] = fiber->stackTop[-numberOfArguments - 1];
+					    builtin ? Bytecode::Opcode::CODE_call_fast_builtin_soft
+					            : Bytecode::Opcode::CODE_call_fast_method_soft;
+					// store the class itself
+					cache[0] = fiber->stackTop[-numberOfArguments - 1];
+					cache[1] = Value(functionToCall);
 					// if we are performing a softcall, it must only
 					// be a constructor call, so clear the 0th slot
 					// so that a new object is constructed by opcode
 					// 'construct'
 					fiber->stackTop[-numberOfArguments - 1] = ValueNil;
-				} else {
-					Locals[idx] = Value(
+				} else if(*CallPatch ==
+				          Bytecode::Opcode::CODE_call_fast_prepare) {
+					// we are performing a normal method call for
+					// the first time
+					*CallPatch = builtin
+					                 ? Bytecode::Opcode::CODE_call_fast_builtin
+					                 : Bytecode::Opcode::CODE_call_fast_method;
+					cache[0] = Value(
 					    fiber->stackTop[-numberOfArguments - 1].getClass());
+					cache[1] = Value(functionToCall);
+				} else {
+					// the receiver has a class which is not cached yet
+					const Class *c =
+					    fiber->stackTop[-numberOfArguments - 1].getClass();
+					int i = 0;
+					while(i < Bytecode::CallCacheHits && cache[i] != ValueNil)
+						i += 2;
+					if(i < Bytecode::CallCacheHits) {
+						*CallPatch   = Bytecode::Opcode::CODE_call_fast_poly;
+						cache[i]     = Value(c);
+						cache[i + 1] = Value(functionToCall);
+					} else {
+						*CallPatch = Bytecode::Opcode::CODE_call_fast_mega;
+						ExecutionEngine::cacheMethod(c, sym, functionToCall);
+					}
 				}
-				// store the function
-				Locals[idx + 1] = Value(functionToCall);
 				// reset the patch pointer
 				CallPatch = nullptr;
-				// restore the ip
-				InstructionPointer = bak;
 			}
 			switch(functionToCall->getType()) {
 				case Function::Type::BUILTIN: {
@@ -1112,6 +1525,10 @@ bool ExecutionEngine::execute(Fiber *fiber, Value *returnValue) {
 					fiber->appendMethodNoBuiltin(functionToCall,
 					                             numberOfArguments, false);
 					RESTORE_FRAMEINFO();
+#ifdef NEXT_USE_JIT
+					if(Jit::hot(functionToCall->code))
+						goto jitenter;
+#endif
 					DISPATCH_WINC();
 					break;
 			}
@@ -1136,6 +1553,12 @@ bool ExecutionEngine::execute(Fiber *fiber, Value *returnValue) {
 				if(fiber->callFrameCount() > 0) {
 					RESTORE_FRAMEINFO();
 					PUSH(v);
+#ifdef NEXT_USE_JIT
+					if(presentFrame->f->code->jit != nullptr) {
+						InstructionPointer++;
+						goto jitenter;
+					}
+#endif
 					DISPATCH();
 				} else if(fiber->parent != NULL) {
 					// if there is no callframe in present
@@ -1242,6 +1665,7 @@ bool ExecutionEngine::execute(Fiber *fiber, Value *returnValue) {
 			CASE(store_tos_slot) : {
 				Value v                         = POP();
 				v.toObject()->slots(next_int()) = TOP;
+				Gc::writeBarrier(v.toGcObject(), TOP);
 				DISPATCH();
 			}
 
@@ -1254,6 +1678,15 @@ bool ExecutionEngine::execute(Fiber *fiber, Value *returnValue) {
 			CASE(store_object_slot) : {
 				int slot                         = next_int();
 				Stack[0].toObject()->slots(slot) = TOP;
+				Gc::writeBarrier(Stack[0].toGcObject(), TOP);
+				DISPATCH();
+			}
+
+			CASE(store_object_slot_pop) : {
+				int slot                         = next_int();
+				Stack[0].toObject()->slots(slot) = TOP;
+				Gc::writeBarrier(Stack[0].toGcObject(), TOP);
+				DROP();
 				DISPATCH();
 			}
 
@@ -1301,6 +1734,66 @@ bool ExecutionEngine::execute(Fiber *fiber, Value *returnValue) {
 				DISPATCH();
 			}
 
+			CASE(load_field_poly) : {
+				// loads the value from the slot of the first
+				// matching class in the cache
+				CallPatch        = InstructionPointer;
+				int          idx = next_int();
+				const Class *c   = TOP.getClass();
+				next_int();
+				// the empty pairs hold nil, which is never a class
+				int i = 0;
+				while(i < 2 * Bytecode::FieldCacheSize &&
+				      Locals[idx + i].toClass() != c)
+					i += 2;
+				if(i < 2 * Bytecode::FieldCacheSize) {
+					CallPatch = nullptr;
+					TOP       = TOP.toObject()->slots(
+					    Locals[idx + i + 1].toSmallInteger());
+					// skip next opcode
+					InstructionPointer++;
+					next_int();
+				}
+				DISPATCH();
+			}
+
+// patches the access at CallPatch for the class c. if the
+// site already holds the slot of another class, the pair of
+// c is appended to the cache, otherwise the site is
+// retargeted to c.
+#define PATCHFIELD(type)                                                       \
+	{                                                                          \
+		int    f     = c->get_fn(field).toInteger();                           \
+		Value *cache = &Locals[*(CallPatch + 1)];                              \
+		bool   slot  = !Class::is_static_slot(f);                              \
+		if(slot && (*CallPatch == Bytecode::CODE_##type##_field_slot ||        \
+		            *CallPatch == Bytecode::CODE_##type##_field_poly)) {       \
+			int i = 0;                                                         \
+			while(i < 2 * Bytecode::FieldCacheSize && cache[i] != ValueNil)    \
+				i += 2;                                                        \
+			if(i < 2 * Bytecode::FieldCacheSize) {                             \
+				*CallPatch   = Bytecode::CODE_##type##_field_poly;             \
+				cache[i]     = Value(c);                                       \
+				cache[i + 1] = Value(f);                                       \
+			}                                                                  \
+		} else if(*CallPatch != Bytecode::CODE_##type##_field_poly) {          \
+			if(slot) {                                                         \
+				/* this is a slot, so store the slot index */                  \
+				*CallPatch       = Bytecode::CODE_##type##_field_slot;         \
+				*(CallPatch + 2) = (Bytecode::Opcode)f;                        \
+				cache[1]         = Value(f);                                   \
+			} else {                                                           \
+				/* this is a static member, so store the decoded index */      \
+				*CallPatch       = Bytecode::CODE_##type##_field_static;       \
+				*(CallPatch + 2) =                                             \
+				    (Bytecode::Opcode)Class::get_static_slot(f);               \
+				cache[1]         = ValueNil;                                   \
+			}                                                                  \
+			/* store the class */                                              \
+			cache[0] = Value(c);                                               \
+		}                                                                      \
+	}
+
 			CASE(load_field) : {
 				int          field = next_int();
 				Value        v     = POP();
@@ -1310,20 +1803,7 @@ bool ExecutionEngine::execute(Fiber *fiber, Value *returnValue) {
 				if(c->type != Class::ClassType::BUILTIN) {
 					// this is not a builtin class, so we can optimize
 					// the access
-					int v = c->get_fn(field).toInteger();
-					if(!Class::is_static_slot(v)) {
-						// this is a slot, so store the slot index
-						*CallPatch       = Bytecode::CODE_load_field_slot;
-						*(CallPatch + 2) = (Bytecode::Opcode)v;
-					} else {
-						// this is a static member, so store the decodes index
-						*CallPatch = Bytecode::CODE_load_field_static;
-						*(CallPatch + 2) =
-						    (Bytecode::Opcode)Class::get_static_slot(v);
-					}
-					int idx = *(CallPatch + 1);
-					// store the class
-					Locals[idx] = Value(c);
+					PATCHFIELD(load);
 				}
 				CallPatch = nullptr;
 				DISPATCH();
@@ -1346,6 +1826,7 @@ bool ExecutionEngine::execute(Fiber *fiber, Value *returnValue) {
 					Value v                   = POP();
 					CallPatch                 = nullptr;
 					v.toObject()->slots(slot) = TOP;
+					Gc::writeBarrier(v.toGcObject(), TOP);
 					// skip next opcode
 					InstructionPointer++;
 					next_int();
@@ -1373,33 +1854,49 @@ bool ExecutionEngine::execute(Fiber *fiber, Value *returnValue) {
 				DISPATCH();
 			}
 
+			CASE(store_field_poly) : {
+				// stores to the slot of the first matching class
+				// in the cache
+				CallPatch        = InstructionPointer;
+				int          idx = next_int();
+				const Class *c   = TOP.getClass();
+				next_int();
+				int i = 0;
+				while(i < 2 * Bytecode::FieldCacheSize &&
+				      Locals[idx + i].toClass() != c)
+					i += 2;
+				if(i < 2 * Bytecode::FieldCacheSize) {
+					Value v   = POP();
+					CallPatch = nullptr;
+					v.toObject()->slots(Locals[idx + i + 1].toSmallInteger()) =
+					    TOP;
+					Gc::writeBarrier(v.toGcObject(), TOP);
+					// skip next opcode
+					InstructionPointer++;
+					next_int();
+				}
+				DISPATCH();
+			}
+
 			CASE(store_field) : {
 				int          field = next_int();
 				Value        v     = POP();
 				const Class *c     = v.getClass();
 				ASSERT_FIELD();
 				c->accessFn(c, v, field) = TOP;
+				if(v.isGcObject())
+					Gc::writeBarrier(v.toGcObject(), TOP);
 				if(c->type != Class::ClassType::BUILTIN) {
 					// this is not a builtin class, so
 					// we can optimize the access
-					int v = c->get_fn(field).toInteger();
-					if(!Class::is_static_slot(v)) {
-						// this is a slot store, so store the slot index
-						*CallPatch       = Bytecode::CODE_store_field_slot;
-						*(CallPatch + 2) = (Bytecode::Opcode)v;
-					} else {
-						// this is a static field store, so store the field
-						*CallPatch = Bytecode::CODE_store_field_static;
-						*(CallPatch + 2) =
-						    (Bytecode::Opcode)Class::get_static_slot(v);
-					}
-					// store the class
-					Locals[*(CallPatch + 1)] = Value(c);
+					PATCHFIELD(store);
 				}
 				CallPatch = nullptr;
 				DISPATCH();
 			}
 
+#undef PATCHFIELD
+
 			CASE(load_static_slot) : {
 				int          slot = next_int();
 				const Class *c    = (next_value()).toClass();
@@ -1532,6 +2029,32 @@ bool ExecutionEngine::execute(Fiber *fiber, Value *returnValue) {
 				}
 			}
 		}
+#ifdef NEXT_USE_JIT
+	jitenter : {
+		// InstructionPointer points to the instruction to execute
+		table       = dispatchTable;
+		void *entry = Jit::entry(presentFrame->f->code, InstructionPointer);
+		if(entry == nullptr) {
+			// try again after this instruction
+			if(presentFrame->f->code->jit != nullptr)
+				table = jitTable;
+			goto *dispatchTable[*InstructionPointer];
+		}
+		int64_t offset = Jit::enter(fiber, entry);
+		// the compiled code may have switched the frame, or
+		// a builtin it has called may have switched the fiber
+		fiber = currentFiber;
+		RESTORE_FRAMEINFO();
+		if(offset == Jit::THROWN)
+			goto error;
+		if(offset >= 0)
+			InstructionPointer = presentFrame->f->code->bytecodes + offset;
+		// interpret the instruction it has exited at, and
+		// enter again right after that
+		table = jitTable;
+		goto *dispatchTable[*InstructionPointer];
+	}
+#endif
 	error:
 		// Only way we can get here is by a 'goto error'
 		// statement, which was triggered either by a
@@ -25,6 +25,20 @@ class ExecutionEngine {
 
 	static void printRemainingExceptions();
 
+	// functions of the megamorphic call sites, indexed by
+	// a hash of the class of the receiver and the symbol
+	struct MethodCacheEntry {
+		const Class *klass;
+		int          symbol;
+		Function *   function;
+	};
+	static const std::size_t MethodCacheSize = 1024;
+	static MethodCacheEntry  methodCache[MethodCacheSize];
+	static std::size_t       methodCacheIndex(const Class *c, int sym) {
+		return (((uintptr_t)c >> 4) ^ ((uintptr_t)sym * 0x9E3779B1)) &
+		       (MethodCacheSize - 1);
+	}
+
 	// denotes whether or not repl is running
 	static bool isRunningRepl;
 
@@ -36,6 +50,9 @@ class ExecutionEngine {
 
   public:
 	static void      mark();
+	// releases the modules which were not marked
+	// in the last gc cycle
+	static void      removeUnmarkedModules();
 	static void      init();
 	static bool      isModuleRegistered(Value filename);
 	static GcObject *getRegisteredModule(Value filename);
@@ -78,6 +95,8 @@ class ExecutionEngine {
 
 	static Fiber *getCurrentFiber() { return currentFiber; }
 	static void   setCurrentFiber(Fiber *f) { currentFiber = f; }
+	// returns true if there are unhandled exceptions
+	static bool hasPendingExceptions();
 
 	static std::size_t getMaxRecursionLimit() { return maxRecursionLimit; }
 	static void setMaxRecursionLimit(std::size_t n) { maxRecursionLimit = n; }
@@ -90,4 +109,14 @@ class ExecutionEngine {
 	static bool getHash(const Value &v, Value *generatedHash);
 
 	static void setRunningRepl(bool status);
+
+	// returns the function cached for the symbol on the
+	// class, or null if there is none
+	static Function *lookupMethod(const Class *c, int sym) {
+		MethodCacheEntry &e = methodCache[methodCacheIndex(c, sym)];
+		return e.klass == c && e.symbol == sym ? e.function : nullptr;
+	}
+	static void cacheMethod(const Class *c, int sym, Function *f) {
+		methodCache[methodCacheIndex(c, sym)] = {c, sym, f};
+	}
 };
@@ -10,14 +10,75 @@
 #include "objects/tuple.h"
 #include "printer.h"
 #include "stmt.h"
+#include "stream.h"
 #include "utils.h"
 
-size_t          Gc::totalAllocated   = 0;
-size_t          Gc::next_gc          = 1024 * 1024 * 10;
-size_t          Gc::max_gc           = 1024 * 1024 * 1024;
-Gc::Generation *Gc::generations[]    = {nullptr};
-size_t          Gc::gc_count         = 0;
-Set *           Gc::temporaryObjects = nullptr;
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#ifdef GC_PARALLEL_MARK
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#endif
+
+size_t          Gc::totalAllocated       = 0;
+size_t          Gc::next_gc              = 1024 * 1024 * 10;
+size_t          Gc::max_gc               = 1024 * 1024 * 1024;
+size_t          Gc::largeAllocated       = 0;
+size_t          Gc::next_large_gc        = 1024 * 1024 * 64;
+bool            Gc::fullCollection       = false;
+Gc::Generation *Gc::generations[]        = {nullptr};
+size_t          Gc::gc_count             = 0;
+Set *           Gc::temporaryObjects     = nullptr;
+Gc::GrayList *  Gc::grayList             = nullptr;
+Gc::GrayList *  Gc::rescanList           = nullptr;
+size_t          Gc::incrementalBudget    = 0;
+bool            Gc::isMarking            = false;
+bool            Gc::regrayMarked         = false;
+size_t          Gc::collectingGeneration = 0;
+Gc::GrayList *  Gc::rememberedSet        = nullptr;
+Gc::Generation *Gc::stringGenerations[]  = {nullptr};
+Gc::Generation *Gc::unsweptGenerations[] = {nullptr};
+size_t          Gc::sweepPending         = 0;
+size_t          Gc::sweepIndex           = 0;
+bool            Gc::isSweeping           = false;
+bool            Gc::sweepForced          = false;
+size_t          Gc::pauseHistogram[GC_PAUSE_HISTOGRAM_BUCKETS] = {0};
+size_t          Gc::numCollections[GC_NUM_GENERATIONS]         = {0};
+size_t          Gc::numPauses                                  = 0;
+size_t          Gc::totalPause                                 = 0;
+size_t          Gc::maxPause                                   = 0;
+size_t          Gc::typeAllocations[]                          = {
+    0,
+#define OBJTYPE(n, c) 0,
+#include "objecttype.h"
+};
+size_t Gc::typeAllocatedBytes[] = {
+    0,
+#define OBJTYPE(n, c) 0,
+#include "objecttype.h"
+};
+
+char * Gc::nursery                        = nullptr;
+char * Gc::nurseryTop                     = nullptr;
+char * Gc::nurseryEnd                     = nullptr;
+size_t Gc::nurseryCurrent                 = GC_NURSERY_BLOCKS;
+size_t Gc::nurseryLive[GC_NURSERY_BLOCKS] = {0};
+size_t Gc::nurseryFree[GC_NURSERY_BLOCKS] = {0};
+size_t Gc::nurseryNumFree                 = 0;
+
+// the remembered set is rebuilt on every collection
+// into this list
+static Gc::GrayList *rememberedSetSwap = nullptr;
+// an unmarked class may still have some objects
+// alive, so we hold its release until the sweep is
+// finished using this singly linked list of unmarked
+// classes, linked through Class::module
+static Class *unmarkedClassesHead = nullptr;
 
 #ifdef DEBUG_GC
 size_t Gc::GcCounters[] = {
@@ -71,7 +132,7 @@ static size_t counterCounter = 0;
 
 void *Gc::malloc(size_t bytes) {
 	void *m = MALLOC(bytes);
-	totalAllocated += bytes;
+	allocatedFor(bytes) += bytes;
 	STORE_SIZE(m, bytes);
 	return m;
 }
@@ -84,153 +145,459 @@ void *Gc::calloc(size_t num, size_t bytes) {
 	std::fill_n(&((uint8_t *)m)[(num * bytes)], sizeof(size_t), 0);
 	STORE_SIZE(m, bytes);
 #endif
-	totalAllocated += (num * bytes);
+	allocatedFor(num * bytes) += (num * bytes);
 	return m;
 }
 
 void *Gc::realloc(void *mem, size_t oldb, size_t newb) {
 	void *n = REALLOC(mem, oldb, newb);
-	totalAllocated += newb;
-	totalAllocated -= oldb;
+	allocatedFor(newb) += newb;
+	allocatedFor(oldb) -= oldb;
 	STORE_SIZE(n, newb);
 	return n;
 }
 
 void Gc::free(void *mem, size_t bytes) {
-	FREE(mem, bytes);
-	totalAllocated -= bytes;
+	if(inNursery(mem))
+		nurseryRelease(mem);
+	else
+		FREE(mem, bytes);
+	allocatedFor(bytes) -= bytes;
+}
+
+void *Gc::nurseryAlloc(size_t bytes) {
+#ifdef GC_USE_STD_ALLOC
+	(void)bytes;
+	return nullptr;
+#else
+	size_t size = MemoryManager::blockNearest(bytes);
+	if(size > GC_NURSERY_MAX_OBJECT)
+		return nullptr;
+	if(nurseryTop + size > nurseryEnd) {
+		// the current block is full, if everything in
+		// it is already released, it can be reused
+		if(nurseryCurrent < GC_NURSERY_BLOCKS &&
+		   nurseryLive[nurseryCurrent] == 0)
+			nurseryFree[nurseryNumFree++] = nurseryCurrent;
+		nurseryCurrent = GC_NURSERY_BLOCKS;
+		nurseryTop = nurseryEnd = nullptr;
+		if(nurseryNumFree == 0)
+			return nullptr;
+		nurseryCurrent = nurseryFree[--nurseryNumFree];
+		nurseryTop     = nursery + nurseryCurrent * GC_NURSERY_BLOCK_SIZE;
+		nurseryEnd     = nurseryTop + GC_NURSERY_BLOCK_SIZE;
+	}
+	void *m = nurseryTop;
+	nurseryTop += size;
+	nurseryLive[nurseryCurrent]++;
+	totalAllocated += bytes;
+	return m;
+#endif
+}
+
+void Gc::nurseryRelease(void *mem) {
+	size_t block = ((char *)mem - nursery) / GC_NURSERY_BLOCK_SIZE;
+	// the current block is checked when it is full
+	if(--nurseryLive[block] == 0 && block != nurseryCurrent)
+		nurseryFree[nurseryNumFree++] = block;
 }
 #define OBJTYPE(n, c) \
 	template <> GcObject::Type GcObject::getType<n>() { return Type::n; }
 #include "objecttype.h"
 
+// records the time elapsed since 'start' in the pause histogram
+static void recordPause(std::chrono::steady_clock::time_point start) {
+	auto   elapsed = std::chrono::steady_clock::now() - start;
+	size_t us =
+	    std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+	Gc::numPauses++;
+	Gc::totalPause += us;
+	if(us > Gc::maxPause)
+		Gc::maxPause = us;
+	size_t bucket = 0;
+	while(us > 1 && bucket < GC_PAUSE_HISTOGRAM_BUCKETS - 1) {
+		us >>= 1;
+		bucket++;
+	}
+	Gc::pauseHistogram[bucket]++;
+}
+
+void Gc::markRoots() {
+#ifdef GC_PRINT_CLEANUP
+	Printer::println("Marking core..");
+#endif
+	mark(ExecutionEngine::CoreObject);
+#ifdef GC_PRINT_CLEANUP
+	Printer::println("Marking ErrorObjectClass..");
+#endif
+	mark(Error::ErrorObjectClass);
+#ifdef GC_PRINT_CLEANUP
+	Printer::println("[GC] Marking weak strings..");
+#endif
+	String::keep();
+#ifdef GC_PRINT_CLEANUP
+	Printer::println("[GC] Marking symbol table..");
+#endif
+	SymbolTable2::mark();
+#ifdef GC_PRINT_CLEANUP
+	Printer::println("[GC] Marking Engine..");
+#endif
+	ExecutionEngine::mark();
+#ifdef GC_PRINT_CLEANUP
+	Printer::println("[GC] Marking temporary objects..");
+#endif
+	mark(temporaryObjects);
+}
+
 void Gc::gc(bool force) {
+	if(isSweeping) {
+		// the budget is not updated until the
+		// sweep is finished
+		if(!force)
+			return;
+		finishSweep();
+	}
+	if(isMarking) {
+		// an incremental cycle is already running,
+		// so finish it right away if we are forced to
+		if(force) {
+			auto start = std::chrono::steady_clock::now();
+			finishCycle(true);
+			recordPause(start);
+		}
+		return;
+	}
 	// check for gc
-	if(totalAllocated >= next_gc || force) {
-		gc_count++;
+	if(totalAllocated >= next_gc || largeAllocated >= next_large_gc || force) {
+		auto start = std::chrono::steady_clock::now();
+		if(incrementalBudget > 0 && !force) {
+			startCycle();
+			recordPause(start);
+			return;
+		}
+		beginCycle();
 #ifdef GC_PRINT_CLEANUP
 		Printer::println("[GC] Started GC..");
-		size_t oldAllocated = totalAllocated;
 		Printer::println("[GC] [Before] Allocated: ", totalAllocated, " bytes");
 		Printer::println("[GC] [Before] NextGC: ", next_gc, " bytes");
 		Printer::println("[GC] MaxGC: ", max_gc, " bytes");
 #endif
-#ifdef GC_PRINT_CLEANUP
-		Printer::println("Marking core..");
+		markRoots();
+		scanRemembered();
+		drainAll();
+		collect(force);
+		recordPause(start);
+	}
+}
+
+size_t Gc::compact() {
+	// finish the running cycle, if there is one
+	if(isMarking)
+		gc(true);
+	fullCollection = true;
+	gc(true);
+	fullCollection = false;
+	if(isSweeping)
+		finishSweep();
+#ifdef GC_USE_STD_ALLOC
+	return 0;
+#else
+	return MemoryManager::trim();
 #endif
-		mark(ExecutionEngine::CoreObject);
-#ifdef GC_PRINT_CLEANUP
-		Printer::println("Marking ErrorObjectClass..");
+}
+
+// adds the number and the size of the objects in gen,
+// from index 'from'. when a sweep is pending, the marked
+// objects are counted in the generation they are promoted
+// to, and the rest as unswept.
+static void countObjects(Gc::Generation *gen, size_t from, Gc::Stats &s,
+                         size_t genid, bool unswept) {
+	for(size_t i = from; i < gen->size; i++) {
+		GcObject *o = gen->at(i);
+		// the dependencies are cleared in debug mode
+		if(o == nullptr)
+			continue;
+		size_t bytes = Gc::sizeOf(o);
+		if(unswept && !o->isMarked()) {
+			s.unsweptObjects++;
+			s.unsweptBytes += bytes;
+		} else {
+			size_t g = unswept ? o->getGeneration() : genid;
+			s.objects[g]++;
+			s.bytes[g] += bytes;
+		}
+	}
+}
+
+void Gc::stats(Stats &s) {
+	s.unsweptObjects = s.unsweptBytes = 0;
+	for(size_t i = 0; i < GC_NUM_GENERATIONS; i++) s.objects[i] = s.bytes[i] = 0;
+	for(size_t i = 0; i < GC_NUM_GENERATIONS; i++) {
+		countObjects(generations[i], 0, s, i, false);
+		countObjects(stringGenerations[i], 0, s, i, false);
+		// the last pending generation is partly swept
+		if(i < sweepPending)
+			countObjects(unsweptGenerations[i],
+			             i == sweepPending - 1 ? sweepIndex : 0, s, i, true);
+	}
+#ifdef GC_USE_STD_ALLOC
+	s.poolUsed = s.poolResident = s.largeCacheResident = 0;
+	s.nurseryFreeBlocks                                = 0;
+#else
+	MemoryManager::usage(s.poolUsed, s.poolResident);
+	{
+		std::lock_guard<std::mutex> l(MemoryManager::largeLock);
+		s.largeCacheResident = MemoryManager::largeCacheResident;
+	}
+	s.nurseryFreeBlocks = nurseryNumFree;
 #endif
-		mark(Error::ErrorObjectClass);
+}
+
+void Gc::walk(void (*fn)(GcObject *o, void *data), void *data) {
+	for(size_t i = 0; i < GC_NUM_GENERATIONS; i++) {
+		Generation *g = generations[i];
+		for(size_t j = 0; j < g->size; j++)
+			if(g->at(j) != nullptr)
+				fn(g->at(j), data);
+		if(i >= sweepPending)
+			continue;
+		// only the marked ones of the unswept objects are live
+		g = unsweptGenerations[i];
+		for(size_t j = i == sweepPending - 1 ? sweepIndex : 0; j < g->size;
+		    j++)
+			if(g->at(j) != nullptr && g->at(j)->isMarked())
+				fn(g->at(j), data);
+	}
+}
+
+void Gc::dumpStats(WritableStream &w) {
+	Stats s;
+	stats(s);
+	Printer::print(w, "{\n  \"allocated\": ", totalAllocated,
+	               ",\n  \"next_gc\": ", next_gc,
+	               ",\n  \"large_allocated\": ", largeAllocated,
+	               ",\n  \"next_large_gc\": ", next_large_gc,
+	               ",\n  \"pauses\": ", numPauses,
+	               ",\n  \"total_pause_us\": ", totalPause,
+	               ",\n  \"max_pause_us\": ", maxPause,
+	               ",\n  \"generations\": [");
+	for(size_t i = 0; i < GC_NUM_GENERATIONS; i++)
+		Printer::print(w, i ? "," : "", "\n    {\"collections\": ",
+		               numCollections[i], ", \"objects\": ", s.objects[i],
+		               ", \"bytes\": ", s.bytes[i], "}");
+	Printer::print(w, "\n  ],\n  \"unswept\": {\"objects\": ",
+	               s.unsweptObjects, ", \"bytes\": ", s.unsweptBytes,
+	               "},\n  \"types\": {");
+	const char *sep = "";
+#define OBJTYPE(n, c)                                                  \
+	Printer::print(w, sep, "\n    \"" #n "\": {\"allocations\": ",     \
+	               typeAllocations[(size_t)GcObject::Type::n],         \
+	               ", \"bytes\": ",                                    \
+	               typeAllocatedBytes[(size_t)GcObject::Type::n], "}"); \
+	sep = ",";
+#include "objecttype.h"
+	Printer::print(w, "\n  },\n  \"memory\": {\"pool_used\": ", s.poolUsed,
+	               ", \"pool_resident\": ", s.poolResident,
+	               ", \"large_cache_resident\": ", s.largeCacheResident,
+	               ", \"nursery_free_blocks\": ", s.nurseryFreeBlocks,
+	               "}\n}\n");
+}
+
+void Gc::beginCycle() {
+	gc_count++;
+	// generation i is collected on every
+	// GC_NEXT_GEN_THRESHOLD^i th cycle
+	collectingGeneration = 0;
+	size_t max           = GC_NEXT_GEN_THRESHOLD;
+	while(collectingGeneration < GC_NUM_GENERATIONS - 1 && gc_count % max == 0) {
+		collectingGeneration++;
+		max *= GC_NEXT_GEN_THRESHOLD;
+	}
+	// the owners of the large buffers may be of any age
+	if(fullCollection || largeAllocated >= next_large_gc)
+		collectingGeneration = GC_NUM_GENERATIONS - 1;
+}
+
+void Gc::startCycle() {
+	beginCycle();
 #ifdef GC_PRINT_CLEANUP
-		Printer::println("[GC] Marking weak strings..");
+	Printer::println("[GC] Started incremental GC..");
+	Printer::println("[GC] [Before] Allocated: ", totalAllocated, " bytes");
 #endif
-		String::keep();
+	isMarking = true;
+	markRoots();
+	scanRemembered();
+}
+
+void Gc::step() {
+	auto start = std::chrono::steady_clock::now();
+	// if the mutator is allocating faster than we can
+	// mark, don't let the heap grow unbounded, and
+	// finish the cycle in one go
+	if(drain(incrementalBudget) || totalAllocated >= next_gc * 2 ||
+	   largeAllocated >= next_large_gc * 2)
+		finishCycle(false);
+	recordPause(start);
+}
+
+void Gc::finishCycle(bool force) {
 #ifdef GC_PRINT_CLEANUP
-		Printer::println("[GC] Marking symbol table..");
+	Printer::println("[GC] Finishing incremental GC..");
 #endif
-		SymbolTable2::mark();
+	isMarking = false;
+	// the roots are not guarded by the barrier, so
+	// scan all of them again
+	regrayMarked = true;
+	markRoots();
+	regrayMarked = false;
+	// and the objects which are mutated without the
+	// barrier
+	for(size_t i = 0; i < rescanList->size; i++) scan(rescanList->at(i));
+	rescanList->size = 0;
+	rescanList->shrink();
+	drainAll();
+	collect(force);
+}
+
+void Gc::setIncrementalBudget(size_t v) {
+	// if we are turning off incremental marking,
+	// finish the running cycle
+	if(v == 0 && isMarking)
+		finishCycle(false);
+	incrementalBudget = v;
+}
+
 #ifdef GC_PRINT_CLEANUP
-		Printer::println("[GC] Marking Engine..");
+static size_t allocatedBeforeCollect = 0;
 #endif
-		ExecutionEngine::mark();
+
+void Gc::collect(bool force) {
 #ifdef GC_PRINT_CLEANUP
-		Printer::println("[GC] Marking temporary objects..");
-#endif
-		mark(temporaryObjects);
-
-		size_t max = 1;
-		// make this constant
-		for(size_t i = 0; i < GC_NUM_GENERATIONS - 1; i++)
-			max *= GC_NEXT_GEN_THRESHOLD;
-		size_t maxbak = max;
-		// for an unmarked class, it may still have
-		// some objects alive, so we hold its release
-		// until they are done using this singly
-		// linked list of unmarked classes.
-		Class *unmarkedClassesHead = nullptr;
+	allocatedBeforeCollect = totalAllocated;
+#endif
+	numCollections[collectingGeneration]++;
+	grayList->shrink();
+	// marking is complete, so release the
+	// unmarked modules
+	ExecutionEngine::removeUnmarkedModules();
+
 #ifdef DEBUG_GC
-		for(size_t i = GC_NUM_GENERATIONS; i > 0;) {
-			--i;
-			if(gc_count % max == 0) {
-				Printer::println("[GC] Checking dependency for generation ", i,
-				                 "..");
-				Generation *generation = generations[i];
-				size_t      oldsize    = generation->size;
-				// for all unmarked values, call depend
-				for(size_t j = 0; j < oldsize; j++) {
-					GcObject *v = generation->at(j);
-					if(v && !v->isMarked()) {
-						v->depend_();
-					}
-				}
+	for(size_t i = collectingGeneration + 1; i > 0;) {
+		--i;
+		Printer::println("[GC] Checking dependency for generation ", i, "..");
+		Generation *generation = generations[i];
+		size_t      oldsize    = generation->size;
+		// for all unmarked values, call depend
+		for(size_t j = 0; j < oldsize; j++) {
+			GcObject *v = generation->at(j);
+			if(v && !v->isMarked()) {
+				v->depend_();
 			}
-			max /= GC_NEXT_GEN_THRESHOLD;
 		}
-		max = maxbak;
+	}
 #endif
-		for(size_t i = GC_NUM_GENERATIONS; i > 0;) {
-			--i;
-			if(gc_count % max == 0) {
+	pruneRemembered();
+	// objects in the older generations are never
+	// marked, so they don't need to be unmarked
+	// either.
+	for(size_t i = collectingGeneration + 1; i > 0;) {
+		--i;
 #ifdef GC_PRINT_CLEANUP
-				Printer::println("[GC] Sweeping generation ", i, "..");
+		Printer::println("[GC] Sweeping strings of generation ", i, "..");
 #endif
-				// do a sweep if it is time for a sweep
-				sweep(i, &unmarkedClassesHead);
-#ifdef GC_PRINT_CLEANUP
-				Printer::println("[GC] Sweeping generation ", i, " finished..");
+		sweep(stringGenerations, i);
+	}
+	// the rest are swept on the following allocations
+	for(size_t i = 0; i <= collectingGeneration; i++)
+		std::swap(generations[i], unsweptGenerations[i]);
+	sweepPending = collectingGeneration + 1;
+	sweepIndex   = 0;
+	isSweeping   = true;
+	sweepForced  = force;
+	// if we have swept even the final generation, it's time
+	// for a reset.
+	if(collectingGeneration == GC_NUM_GENERATIONS - 1)
+		gc_count = 0;
+#ifndef DEBUG_GC
+	if(GC_STRESS)
 #endif
-			} else {
+		finishSweep();
+}
+
+bool Gc::sweepStep(size_t budget) {
+	while(sweepPending > 0) {
+		// older generations are swept first
+		size_t      genid      = sweepPending - 1;
+		Generation *generation = unsweptGenerations[genid];
+		size_t      put = genid < GC_NUM_GENERATIONS - 1 ? genid + 1 : genid;
 #ifdef GC_PRINT_CLEANUP
-				Printer::println("[GC] Unmarking generation ", i, "..");
+		if(sweepIndex == 0)
+			Printer::println("[GC] Sweeping generation ", genid, "..");
 #endif
-				Generation *gen = generations[i];
-				// otherwise, just unmark everyone in this generation
-				for(size_t j = 0; j < gen->size; j++) {
-#ifdef DEBUG_GC
-					if(gen->at(j))
-#endif
-						gen->at(j)->unmarkOwn();
-				}
-			}
-			max /= GC_NEXT_GEN_THRESHOLD;
+		while(sweepIndex < generation->size) {
+			if(budget == 0)
+				return false;
+			sweep(generation->at(sweepIndex++), generations, put);
+			budget--;
 		}
-		// release all unmarked classes
-		while(unmarkedClassesHead) {
-			Class *next = unmarkedClassesHead->module;
-			release(unmarkedClassesHead);
-			unmarkedClassesHead = next;
-		}
-		// if we have swept even the final generation, it's time
-		// for a reset.
-		if(gc_count == maxbak)
-			gc_count = 0;
-		// check the ceiling of where the program
-		// has already hit
-		size_t c = Utils::powerOf2Ceil(totalAllocated);
-		// this is our budget
-		if(!force)
-			next_gc *= 2;
-		if(next_gc > max_gc)
-			next_gc = max_gc;
-		// if the ceiling is
-		// greater than our budget, that is our
-		// new budget
-		if(next_gc < c)
-			next_gc = c;
+		generation->size = 0;
+		generation->shrink();
+		sweepIndex = 0;
+		sweepPending--;
+	}
+	finishSweep();
+	return true;
+}
+
+void Gc::finishSweep() {
+	if(sweepPending > 0) {
+		// this calls us back once it is done
+		sweepStep();
+		return;
+	}
+	// release all unmarked classes
+	while(unmarkedClassesHead) {
+		Class *next = unmarkedClassesHead->module;
+		release((GcObject *)unmarkedClassesHead);
+		unmarkedClassesHead = next;
+	}
+	isSweeping = false;
+	// check the ceiling of where the program
+	// has already hit
+	size_t c = Utils::powerOf2Ceil(totalAllocated);
+	// this is our budget
+	if(!sweepForced)
+		next_gc *= 2;
+	if(next_gc > max_gc)
+		next_gc = max_gc;
+	// if the ceiling is
+	// greater than our budget, that is our
+	// new budget
+	if(next_gc < c)
+		next_gc = c;
+	// the large budget only grows with the
+	// live large buffers
+	c = Utils::powerOf2Ceil(largeAllocated * 2);
+	if(next_large_gc < c)
+		next_large_gc = c;
 #ifndef GC_USE_STD_ALLOC
-		// try to release any empty arenas
-		MemoryManager::releaseArenas();
+	// try to release any empty arenas
+	MemoryManager::releaseArenas();
+	// if the rest are sparsely populated, at least
+	// give the memory of the free pools back
+	size_t used, resident;
+	MemoryManager::usage(used, resident);
+	if(resident >= GC_TRIM_MIN_RESIDENT &&
+	   used * 100 < resident * GC_TRIM_OCCUPANCY)
+		MemoryManager::trim();
 #endif
 #ifdef GC_PRINT_CLEANUP
-		Printer::println("[GC] Released: ", oldAllocated - totalAllocated,
-		                 " bytes");
-		Printer::println("[GC] [After] Allocated: ", totalAllocated, " bytes");
-		Printer::println("[GC] [After] NextGC: ", next_gc, " bytes");
-		Printer::println("[GC] Finished GC..");
+	Printer::println("[GC] Released: ", allocatedBeforeCollect - totalAllocated,
+	                 " bytes");
+	Printer::println("[GC] [After] Allocated: ", totalAllocated, " bytes");
+	Printer::println("[GC] [After] NextGC: ", next_gc, " bytes");
+	Printer::println("[GC] Finished GC..");
 #endif
-	}
 }
 
 void Gc::setNextGC(size_t v) {
@@ -242,10 +609,15 @@ void Gc::setMaxGC(size_t v) {
 }
 
 void Gc::tracker_insert(GcObject *g) {
-	generations[0]->insert(g);
+	g->setGeneration(0);
 #ifdef DEBUG_GC
+	// depend_() expects everything to be in the
+	// same generations
+	generations[0]->insert(g);
 	g->gen = 0;
 	g->idx = generations[0]->size - 1;
+#else
+	stringGenerations[0]->insert(g);
 #endif
 }
 
@@ -253,10 +625,19 @@ void *Gc::alloc(size_t s, GcObject::Type type, const Class *klass) {
 	// try for gc before allocation
 	// because the returned pointer
 	// may be less fragmented
-	gc(GC_STRESS);
+	if(isSweeping)
+		sweepStep(GC_LAZY_SWEEP_BUDGET);
+	if(isMarking)
+		step();
+	else
+		gc(GC_STRESS);
 
-	GcObject *obj = (GcObject *)Gc::malloc(s);
+	GcObject *obj = (GcObject *)nurseryAlloc(s);
+	if(obj == nullptr)
+		obj = (GcObject *)Gc::malloc(s);
 	obj->setType(type, klass);
+	typeAllocations[(size_t)type]++;
+	typeAllocatedBytes[(size_t)type] += s;
 
 	generations[0]->insert(obj);
 #ifdef DEBUG_GC
@@ -297,6 +678,9 @@ String *Gc::allocString2(int numchar) {
 	// duplicate strings are freed immediately
 	String *s = (String *)Gc_malloc(sizeof(String) + (sizeof(char) * numchar));
 	s->obj.setType(GcObject::Type::String, Classes::get<String>());
+	typeAllocations[(size_t)GcObject::Type::String]++;
+	typeAllocatedBytes[(size_t)GcObject::Type::String] +=
+	    sizeof(String) + (sizeof(char) * numchar);
 #ifdef DEBUG_GC
 	GcCounters[StringCounter]++;
 #endif
@@ -358,25 +742,22 @@ Statement *Gc::allocStatement2(size_t size) {
 	}
 #endif
 
-void Gc::release(GcObject *obj) {
+size_t Gc::sizeOf(GcObject *obj) {
 	// for the types that are allocated contiguously,
 	// we need to pass the total allocated size to
 	// the memory manager, otherwise it will add the
 	// block to a different pool than the original
 	switch(obj->getType()) {
 		case GcObject::Type::String:
-			release_(String, sizeof(String) +
-			                     (sizeof(char) * ((String *)obj)->size + 1));
+			return sizeof(String) + (sizeof(char) * ((String *)obj)->size + 1);
 		case GcObject::Type::Tuple:
-			release_(Tuple,
-			         sizeof(Tuple) + (sizeof(Value) * ((Tuple *)obj)->size));
+			return sizeof(Tuple) + (sizeof(Value) * ((Tuple *)obj)->size);
 		case GcObject::Type::Object:
-			release_(Object, sizeof(Object) +
-			                     (sizeof(Value) * obj->getClass()->numSlots));
+			return sizeof(Object) + (sizeof(Value) * obj->getClass()->numSlots);
 		case GcObject::Type::Expression:
-			release_(Expression, ((Expression *)obj)->getSize());
+			return ((Expression *)obj)->getSize();
 		case GcObject::Type::Statement:
-			release_(Statement, ((Statement *)obj)->getSize());
+			return ((Statement *)obj)->getSize();
 		default: break;
 	}
 	switch(obj->getType()) {
@@ -384,11 +765,18 @@ void Gc::release(GcObject *obj) {
 			panic("Object type NONE should not be present in "
 			      "the list!");
 			break;
-#define OBJTYPE(n, c)                                  \
-	case GcObject::Type::n: {                          \
-		release_(n, Classes::n##ClassInfo.ObjectSize); \
-		break;                                         \
+#define OBJTYPE(n, c) \
+	case GcObject::Type::n: return Classes::n##ClassInfo.ObjectSize;
+#include "objecttype.h"
+		default: panic("Invalid object tag!"); break;
 	}
+	return 0;
+}
+
+void Gc::release(GcObject *obj) {
+	switch(obj->getType()) {
+#define OBJTYPE(n, c) \
+	case GcObject::Type::n: release_(n, sizeOf(obj));
 #include "objecttype.h"
 		default: panic("Invalid object tag!"); break;
 	}
@@ -410,22 +798,239 @@ void Gc::mark(Value *v, size_t num) {
 	}
 }
 
+#ifdef GC_PARALLEL_MARK
+#define GC_THREAD_LOCAL thread_local
+#else
+#define GC_THREAD_LOCAL
+#endif
+
+// the generation of the object being scanned after
+// this collection, and whether it points to an object
+// which will be younger than that
+static GC_THREAD_LOCAL size_t scannedGeneration = 0;
+static GC_THREAD_LOCAL bool   scannedHasYounger = false;
+
+#ifdef GC_PARALLEL_MARK
+struct MarkWorker {
+	// gray objects of this worker. the owner pushes and
+	// pops at the back, others steal from the front.
+	std::mutex             lock;
+	std::deque<GcObject *> objects;
+	// objects remembered by this worker, they are
+	// merged into the remembered set after marking,
+	// since the set is not thread safe
+	std::vector<GcObject *> remembered;
+
+	void push(GcObject *p) {
+		std::lock_guard<std::mutex> l(lock);
+		objects.push_back(p);
+	}
+
+	GcObject *pop() {
+		std::lock_guard<std::mutex> l(lock);
+		if(objects.empty())
+			return nullptr;
+		GcObject *p = objects.back();
+		objects.pop_back();
+		return p;
+	}
+
+	GcObject *steal() {
+		std::lock_guard<std::mutex> l(lock);
+		if(objects.empty())
+			return nullptr;
+		GcObject *p = objects.front();
+		objects.pop_front();
+		return p;
+	}
+};
+
+size_t Gc::markThreads = std::thread::hardware_concurrency();
+
+// the worker of the current thread, null
+// when not marking in parallel
+static thread_local MarkWorker *currentWorker = nullptr;
+static std::vector<MarkWorker *> markWorkers;
+static std::atomic<size_t>       idleWorkers;
+// the threads other than the collecting thread wait
+// on poolStart for a new epoch, and the collecting
+// thread waits on poolDone until all of them are done
+static std::vector<std::thread> markPool;
+static std::mutex               poolLock;
+static std::condition_variable  poolStart, poolDone;
+static size_t                   poolEpoch   = 0;
+static size_t                   poolRunning = 0;
+static bool                     poolExit    = false;
+
+static bool hasMarkWork() {
+	for(MarkWorker *w : markWorkers) {
+		std::lock_guard<std::mutex> l(w->lock);
+		if(!w->objects.empty())
+			return true;
+	}
+	return false;
+}
+
+static void runMarkWorker(size_t id) {
+	size_t      count = markWorkers.size();
+	MarkWorker *self  = markWorkers[id];
+	currentWorker     = self;
+	while(true) {
+		GcObject *p = self->pop();
+		// try to steal from the others
+		for(size_t i = 1; p == nullptr && i < count; i++)
+			p = markWorkers[(id + i) % count]->steal();
+		if(p) {
+			Gc::scan(p);
+			continue;
+		}
+		// there is no more work anywhere we looked. only
+		// a working thread can push, so once everyone is
+		// idle, marking is complete.
+		idleWorkers++;
+		while(true) {
+			if(idleWorkers == count) {
+				currentWorker = nullptr;
+				return;
+			}
+			if(hasMarkWork()) {
+				idleWorkers--;
+				break;
+			}
+			std::this_thread::yield();
+		}
+	}
+}
+
+static void markPoolMain(size_t id) {
+	size_t seen = 0;
+	while(true) {
+		{
+			std::unique_lock<std::mutex> l(poolLock);
+			poolStart.wait(l, [&] { return poolExit || poolEpoch != seen; });
+			if(poolExit)
+				return;
+			seen = poolEpoch;
+		}
+		runMarkWorker(id);
+		{
+			std::lock_guard<std::mutex> l(poolLock);
+			if(--poolRunning == 0)
+				poolDone.notify_one();
+		}
+	}
+}
+
+void Gc::setMarkThreads(size_t n) {
+	if(n == 0)
+		n = 1;
+	// stop the existing pool
+	{
+		std::lock_guard<std::mutex> l(poolLock);
+		poolExit = true;
+	}
+	poolStart.notify_all();
+	for(std::thread &t : markPool) t.join();
+	markPool.clear();
+	for(MarkWorker *w : markWorkers) delete w;
+	markWorkers.clear();
+	poolExit    = false;
+	markThreads = n;
+	if(n == 1)
+		return;
+	for(size_t i = 0; i < n; i++) markWorkers.push_back(new MarkWorker());
+	// the collecting thread is worker 0
+	for(size_t i = 1; i < n; i++) markPool.emplace_back(markPoolMain, i);
+}
+
+void Gc::parallelDrain() {
+	size_t count = markWorkers.size();
+	// distribute the gray objects among the workers
+	for(size_t i = 0; i < grayList->size; i++)
+		markWorkers[i % count]->objects.push_back(grayList->at(i));
+	grayList->size = 0;
+	idleWorkers    = 0;
+	{
+		std::lock_guard<std::mutex> l(poolLock);
+		poolEpoch++;
+		poolRunning = count - 1;
+	}
+	poolStart.notify_all();
+	runMarkWorker(0);
+	{
+		std::unique_lock<std::mutex> l(poolLock);
+		poolDone.wait(l, [] { return poolRunning == 0; });
+	}
+	for(MarkWorker *w : markWorkers) {
+		for(GcObject *p : w->remembered) rememberedSet->insert(p);
+		w->remembered.clear();
+	}
+}
+#endif
+
 void Gc::mark(GcObject *p) {
 	if(p == NULL)
 		return;
+	uint64_t priv   = p->getPriv();
+	size_t   gen    = (priv & GcObject::GenerationBits) >> 16;
+	bool     marked = priv & GcObject::Marker;
+	// the generation the object will be in after
+	// this collection. marked objects are already
+	// promoted.
+	size_t promoted = gen;
+	if(!marked && gen <= collectingGeneration && gen < GC_NUM_GENERATIONS - 1)
+		promoted++;
+	if(promoted < scannedGeneration)
+		scannedHasYounger = true;
+	// objects from the older generations are not
+	// traced, the remembered set covers them
+	if(!marked && gen > collectingGeneration)
+		return;
 	// if the object is already marked,
 	// leave it
-	if(p->isMarked())
+	if(p->tryMarkOwn())
+		p->promoteOwn();
+	else if(!regrayMarked)
 		return;
-	// first set the first bit of its class pointer
-	// to mark the object. because in case of the
+	// its members will be marked by drain()
+#ifdef GC_PARALLEL_MARK
+	if(currentWorker) {
+		currentWorker->push(p);
+		return;
+	}
+#endif
+	grayList->insert(p);
+}
+
+// objects of these types are either immutable once built,
+// or are only mutated through paths which call the write
+// barrier. everything else has to be rescanned at the end
+// of an incremental cycle.
+static bool isBarriered(GcObject::Type t) {
+	switch(t) {
+		case GcObject::Type::Object:
+		case GcObject::Type::Array:
+		case GcObject::Type::Map:
+		case GcObject::Type::Set:
+		case GcObject::Type::Tuple:
+		case GcObject::Type::String:
+		case GcObject::Type::BoundMethod:
+		case GcObject::Type::Range:
+		case GcObject::Type::Bits: return true;
+		default: return false;
+	}
+}
+
+void Gc::scan(GcObject *p) {
+	// it is either marked, and hence promoted, or
+	// it is from an older generation
+	scannedGeneration = p->getGeneration();
+	scannedHasYounger = false;
+	// first mark its class. because in case of the
 	// root class, its klass pointer points to the
-	// object itself.
-	const Class *k = p->getClass();
-	p->markOwn();
-	// p->klass = (Class *)((uintptr_t)(p->klass) | marker);
-	// then, mark its class
-	mark((GcObject *)k);
+	// object itself, the object must already be
+	// marked by now.
+	mark((GcObject *)p->getClass());
 	// finally, let it mark its members
 	switch(p->getType()) {
 		case GcObject::Type::None:
@@ -441,68 +1046,171 @@ void Gc::mark(GcObject *p) {
 		break;
 #include "objecttype.h"
 	}
+	bool barriered = isBarriered(p->getType());
+	if(isMarking && !barriered)
+		rescanList->insert(p);
+	// stores to the objects which are not barriered
+	// are not tracked, so remember them as soon as they
+	// are promoted
+	if(scannedHasYounger || (!barriered && scannedGeneration > 0))
+		remember(p);
+	scannedGeneration = 0;
 }
 
-void Gc::sweep(size_t genid, Class **unmarkedClassesHead) {
-	Generation *generation = generations[genid];
-	Generation *put        = generation;
-#ifdef DEBUG_GC
-	size_t parentGen = genid;
-#endif
-	if(genid < GC_NUM_GENERATIONS - 1) {
-		put = generations[genid + 1];
-#ifdef DEBUG_GC
-		parentGen = genid + 1;
+void Gc::remember(GcObject *p) {
+	if(!p->tryRememberOwn())
+		return;
+#ifdef GC_PARALLEL_MARK
+	if(currentWorker) {
+		currentWorker->remembered.push_back(p);
+		return;
+	}
 #endif
+	rememberedSet->insert(p);
+}
+
+void Gc::scanRemembered() {
+	// the set is rebuilt while scanning, so
+	// swap it out first
+	GrayList *old = rememberedSet;
+	rememberedSet = rememberedSetSwap;
+	for(size_t i = 0; i < old->size; i++) old->at(i)->forgetOwn();
+	for(size_t i = 0; i < old->size; i++) {
+		GcObject *p = old->at(i);
+		// the ones from the collected generations
+		// will be scanned if they are reachable
+		if(p->getGeneration() > collectingGeneration)
+			scan(p);
 	}
-	size_t oldsize = generation->size;
-	// set the size of this generation to 0,
-	// so that insert(_) works correctly
-	generation->size = 0;
-	for(size_t i = 0; i < oldsize; i++) {
-		GcObject *v = generation->at(i);
-#ifdef DEBUG_GC
-		if(v == NULL)
+	old->size = 0;
+	old->shrink();
+	rememberedSetSwap = old;
+}
+
+void Gc::pruneRemembered() {
+	size_t j = 0;
+	for(size_t i = 0; i < rememberedSet->size; i++) {
+		GcObject *p = rememberedSet->at(i);
+		// it is going to be released
+		if(p->getGeneration() <= collectingGeneration && !p->isMarked())
 			continue;
+		rememberedSet->at(j++) = p;
+	}
+	rememberedSet->size = j;
+	rememberedSet->shrink();
+}
+
+bool Gc::drain(size_t budget) {
+	while(grayList->size > 0 && budget > 0) {
+		scan(grayList->popLast());
+		budget--;
+	}
+	return grayList->size == 0;
+}
+
+void Gc::drainAll() {
+#ifdef GC_PARALLEL_MARK
+	// small heaps are not worth waking up the
+	// other threads
+	if(markThreads > 1 && !drain(GC_PARALLEL_MARK_THRESHOLD)) {
+		parallelDrain();
+		return;
+	}
 #endif
-		// if it is not marked, release
-		if(!v->isMarked()) {
-			if(v->isClass()) {
-				// it doesn't matter where we store
-				// the pointer now, since everything
-				// is already marked anyway
-				Class *c             = (Class *)v;
-				c->module            = *unmarkedClassesHead;
-				*unmarkedClassesHead = c;
-			} else {
-				release(v);
-			}
-		}
-		// it is marked, shift it left to the
-		// first non empty slot
-		else {
-			v->unmarkOwn();
-			// it survived this generation, so put it in
-			// a parent generation, if there is one
-			put->insert(v);
+	drain();
+}
+
+void Gc::sweep(GcObject *v, Generation **gens, size_t genid) {
 #ifdef DEBUG_GC
-			v->gen = parentGen;
-			v->idx = put->size - 1;
+	if(v == NULL)
+		return;
 #endif
+	// if it is not marked, release
+	if(!v->isMarked()) {
+		if(v->isClass()) {
+			// it doesn't matter where we store
+			// the pointer now, since everything
+			// is already marked anyway
+			Class *c            = (Class *)v;
+			c->module           = unmarkedClassesHead;
+			unmarkedClassesHead = c;
+		} else {
+			release(v);
 		}
 	}
+	// it is marked, and has already been moved to
+	// its parent generation, so track it there
+	else {
+		v->unmarkOwn();
+		gens[genid]->insert(v);
+#ifdef DEBUG_GC
+		v->gen = genid;
+		v->idx = gens[genid]->size - 1;
+#endif
+	}
+}
+
+void Gc::sweep(Generation **gens, size_t genid) {
+	Generation *generation = gens[genid];
+	size_t      oldsize    = generation->size;
+	size_t      put = genid < GC_NUM_GENERATIONS - 1 ? genid + 1 : genid;
+	// set the size of this generation to 0,
+	// so that insert(_) works correctly
+	generation->size = 0;
+	for(size_t i = 0; i < oldsize; i++) sweep(generation->at(i), gens, put);
 	// shrink this generation
 	generation->shrink();
 }
 
+// file to dump the stats to on exit
+static const char *statsPath = nullptr;
+
+static void dumpStatsOnExit() {
+	FILE *f = std::fopen(statsPath, "w");
+	if(f == nullptr) {
+		Printer::Err("Unable to open '", statsPath,
+		             "' to write the GC stats!");
+		return;
+	}
+	FileStream fs(f, FileStream::Mode::Write);
+	Gc::dumpStats(fs);
+	std::fclose(f);
+}
+
 void Gc::init() {
 #ifndef GC_USE_STD_ALLOC
 	// initialize the memory manager
 	MemoryManager::init();
+	// and the nursery
+	nursery = (char *)std::malloc((size_t)GC_NURSERY_BLOCK_SIZE *
+	                              GC_NURSERY_BLOCKS);
+	if(nursery == nullptr) {
+		Printer::Err("Unable to allocate the nursery!");
+		exit(1);
+	}
+	for(size_t i = 0; i < GC_NURSERY_BLOCKS; i++) nurseryFree[i] = i;
+	nurseryNumFree = GC_NURSERY_BLOCKS;
 #endif
 	// initialize the object tracker
-	for(size_t i = 0; i < GC_NUM_GENERATIONS; i++)
-		generations[i] = Generation::create();
+	for(size_t i = 0; i < GC_NUM_GENERATIONS; i++) {
+		generations[i]        = Generation::create();
+		stringGenerations[i]  = Generation::create();
+		unsweptGenerations[i] = Generation::create();
+	}
+	grayList          = GrayList::create();
+	rescanList        = GrayList::create();
+	rememberedSet     = GrayList::create();
+	rememberedSetSwap = GrayList::create();
+#ifdef GC_PARALLEL_MARK
+	// start the marking threads, and stop
+	// them before exiting
+	setMarkThreads(markThreads);
+	std::atexit([] { setMarkThreads(1); });
+#endif
+	// dump the stats on exit if asked to
+	statsPath = std::getenv("NEXT_GC_STATS");
+	if(statsPath != nullptr)
+		std::atexit(dumpStatsOnExit);
 	// init the set class
 	BuiltinModule::register_hooks<Set>(nullptr);
 
@@ -512,8 +1220,10 @@ void Gc::init() {
 
 void Gc::trackTemp(GcObject *g) {
 	g->increaseRefCount();
-	if(g->getRefCount() == 1)
+	if(g->getRefCount() == 1) {
+		writeBarrier(temporaryObjects, Value(g));
 		temporaryObjects->hset.insert(Value(g));
+	}
 }
 
 void Gc::untrackTemp(GcObject *g) {
@@ -532,6 +1242,7 @@ void GcObject::depend_() {
 	Gc::generations[gen]->obj[idx] = NULL;
 	// insert this to generations[0]
 	Gc::generations[0]->insert(this);
+	setGeneration(0);
 	// set the new location
 	gen = 0;
 	idx = Gc::generations[0]->size - 1;
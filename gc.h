@@ -27,6 +27,50 @@
 // before a parent generation is considered for a gc
 #define GC_NEXT_GEN_THRESHOLD 2
 #endif
+#ifdef GC_PARALLEL_MARK
+#ifndef GC_PARALLEL_MARK_THRESHOLD
+// number of objects the collecting thread scans by
+// itself before waking up the other marking threads.
+// most minor collections finish before that.
+#define GC_PARALLEL_MARK_THRESHOLD 4096
+#endif
+#endif
+#ifndef GC_LAZY_SWEEP_BUDGET
+// number of tracked objects swept on each allocation
+// while a sweep is pending
+#define GC_LAZY_SWEEP_BUDGET 64
+#endif
+#ifndef GC_NURSERY_BLOCK_SIZE
+// objects up to GC_NURSERY_MAX_OBJECT bytes are bump
+// allocated from GC_NURSERY_BLOCKS blocks of this size
+#define GC_NURSERY_BLOCK_SIZE (32 * 1024)
+#endif
+#ifndef GC_NURSERY_BLOCKS
+#define GC_NURSERY_BLOCKS 128
+#endif
+#ifndef GC_NURSERY_MAX_OBJECT
+#define GC_NURSERY_MAX_OBJECT 256
+#endif
+#ifndef GC_LARGE_OBJECT_SIZE
+// allocations of at least this many bytes are
+// accounted in Gc::largeAllocated
+#define GC_LARGE_OBJECT_SIZE (32 * 1024)
+#endif
+#ifndef GC_TRIM_OCCUPANCY
+// when less than this percent of the resident pool memory
+// is in use after a collection, the free pools are trimmed
+#define GC_TRIM_OCCUPANCY 50
+#endif
+#ifndef GC_TRIM_MIN_RESIDENT
+// and the pools take at least this many bytes
+#define GC_TRIM_MIN_RESIDENT (16 * 1024 * 1024)
+#endif
+#ifndef GC_PAUSE_HISTOGRAM_BUCKETS
+// number of buckets in the pause time histogram. bucket
+// i counts the pauses that took [2^i, 2^(i+1)) microseconds,
+// the first and last buckets are open ended.
+#define GC_PAUSE_HISTOGRAM_BUCKETS 24
+#endif
 
 #if defined(_MSC_VER)
 #define __PRETTY_FUNCTION__ __FUNCSIG__
@@ -36,6 +80,7 @@ using size_t = std::size_t;
 
 struct Value;
 struct Expr;
+struct WritableStream;
 struct Statement;
 template <typename T, size_t n> struct CustomArray;
 
@@ -66,6 +111,12 @@ struct GcObject {
 	// alive, or use *2 structs, which automatically
 	// does that for you, per scope.
 	//
+	// next 8 bits contains the generation the
+	// object is currently tracked in
+	//
+	// bit 62 marks the object as a member of the
+	// remembered set
+	//
 	// MSB contains the marker bit
 	uint64_t obj_priv;
 
@@ -79,9 +130,19 @@ struct GcObject {
 	inline const Class *getClass() { return klass; }
 	inline void         setClass(Class *c) { klass = c; }
 
+	// reads the header. when marking in parallel, other
+	// threads may be setting bits in it at the same time.
+	inline uint64_t getPriv() {
+#ifdef GC_PARALLEL_MARK
+		return __atomic_load_n(&obj_priv, __ATOMIC_RELAXED);
+#else
+		return obj_priv;
+#endif
+	}
+
 	// last 8 bits
 	static constexpr uint64_t TypeBits = 0x00000000000000ff;
-	inline Type getType() { return (Type)((obj_priv & TypeBits)); }
+	inline Type getType() { return (Type)((getPriv() & TypeBits)); }
 	inline void setType(Type t, const Class *c) {
 		klass    = (Class *)c;
 		obj_priv = (uint64_t)(t);
@@ -112,8 +173,50 @@ struct GcObject {
 	// MSB
 	static constexpr uint64_t Marker = ((uintptr_t)1) << 63;
 	inline void               markOwn() { obj_priv |= Marker; }
-	inline bool               isMarked() { return obj_priv & Marker; }
+	inline bool               isMarked() { return getPriv() & Marker; }
 	inline void               unmarkOwn() { obj_priv &= ~Marker; }
+	// marks the object, returns false if it was
+	// already marked
+	inline bool tryMarkOwn() { return setPrivBit(Marker); }
+
+	// next 8 bits
+	static constexpr uint64_t GenerationBits = 0x0000000000ff0000;
+	inline size_t getGeneration() { return (getPriv() & GenerationBits) >> 16; }
+	inline void setGeneration(size_t g) {
+		obj_priv = (obj_priv & ~GenerationBits) | ((uint64_t)g << 16);
+	}
+	// moves the object to the next generation, if there is one
+	inline void promoteOwn() {
+		if(getGeneration() == GC_NUM_GENERATIONS - 1)
+			return;
+#ifdef GC_PARALLEL_MARK
+		__atomic_fetch_add(&obj_priv, (uint64_t)1 << 16, __ATOMIC_RELAXED);
+#else
+		obj_priv += (uint64_t)1 << 16;
+#endif
+	}
+
+	// bit 62
+	static constexpr uint64_t Remembered = ((uintptr_t)1) << 62;
+	inline void               rememberOwn() { obj_priv |= Remembered; }
+	inline bool               isRemembered() { return getPriv() & Remembered; }
+	inline void               forgetOwn() { obj_priv &= ~Remembered; }
+	// remembers the object, returns false if it was
+	// already remembered
+	inline bool tryRememberOwn() { return setPrivBit(Remembered); }
+
+	// sets the bit, returns false if it was already set.
+	// this is atomic when marking in parallel.
+	inline bool setPrivBit(uint64_t bit) {
+#ifdef GC_PARALLEL_MARK
+		return !(__atomic_fetch_or(&obj_priv, bit, __ATOMIC_RELAXED) & bit);
+#else
+		if(obj_priv & bit)
+			return false;
+		obj_priv |= bit;
+		return true;
+#endif
+	}
 
 	template <typename T> static Type getType() { return Type::None; };
 
@@ -146,16 +249,210 @@ struct Gc {
 	static size_t totalAllocated;
 	static size_t next_gc;
 	static size_t max_gc;
+	// large buffers are accounted separately, so that a few
+	// of them do not cause frequent minor collections. when
+	// they cross their own budget, all the generations are
+	// collected, since their owners may be of any age.
+	static size_t largeAllocated;
+	static size_t next_large_gc;
+	static size_t &allocatedFor(size_t bytes) {
+		return bytes >= GC_LARGE_OBJECT_SIZE ? largeAllocated : totalAllocated;
+	}
 	// an array to track the allocated
 	// objects
 	using Generation = CustomArray<GcObject *, GC_MIN_TRACKED_OBJECTS_CAP>;
 	static Generation *generations[GC_NUM_GENERATIONS];
+	// strings are tracked separately, see below
+	static Generation *stringGenerations[GC_NUM_GENERATIONS];
 	// number of times gc is performed, resets whenever
 	// it is equal to GC_NUM_GENERATIONS * GC_NEXT_GENERATION_THRESHOLD
 	static size_t gc_count;
-	// inserts at generations[0]
+	// inserts at stringGenerations[0]
 	static void tracker_insert(GcObject *g);
 
+	// objects which are marked, but whose members are not
+	// yet marked. mark(GcObject*) only pushes to this list,
+	// the actual tracing is performed by drain(), so that
+	// marking does not recurse on long linked structures.
+	using GrayList = CustomArray<GcObject *, GC_MIN_TRACKED_OBJECTS_CAP>;
+	static GrayList *grayList;
+	// marks the class and the members of an object
+	static void scan(GcObject *p);
+	// scans at most 'budget' objects from the gray list,
+	// returns true if the list is empty afterwards
+	static bool drain(size_t budget = SIZE_MAX);
+	// drains the gray list completely, in parallel
+	// if it is enabled
+	static void drainAll();
+	// marks all the roots
+	static void markRoots();
+	// sweeps the generations after marking is complete
+	static void collect(bool force);
+
+	// lazy sweeping
+	// -------------
+	// a marked object is moved to its next generation right
+	// away, so once marking is complete, collect() only swaps
+	// out the collected generations with empty ones, and the
+	// pause does not depend on the size of the heap. the
+	// swapped out generations are swept GC_LAZY_SWEEP_BUDGET
+	// objects at a time on the following allocations, and the
+	// next collection does not start until they are done, so
+	// that all the objects are unmarked by then. strings are
+	// swept right away, since the string table holds them
+	// weakly, and String::from may hand out a dead one.
+	static Generation *unsweptGenerations[GC_NUM_GENERATIONS];
+	// number of unswept generations left, and the
+	// position in the last one of them
+	static size_t sweepPending;
+	static size_t sweepIndex;
+	static bool   isSweeping;
+	static bool   sweepForced;
+	// sweeps at most 'budget' objects, returns true
+	// if the sweep is finished
+	static bool sweepStep(size_t budget = SIZE_MAX);
+	// sweeps everything that is left, and updates
+	// the budget for the next collection
+	static void finishSweep();
+
+	// generational marking
+	// --------------------
+	// a collection sweeps generations 0 to collectingGeneration,
+	// and only those are traced. objects from older generations
+	// are assumed to be live, and the ones which may point to
+	// a younger object are kept in the remembered set, which
+	// is scanned along with the roots. the set is populated by
+	// writeBarrier, and rebuilt while scanning. objects of the
+	// types which are not covered by the barrier are always
+	// remembered once they are promoted.
+	static size_t    collectingGeneration;
+	static GrayList *rememberedSet;
+	static void      remember(GcObject *p);
+	// scans the remembered objects from the older generations
+	static void scanRemembered();
+	// removes the remembered objects which are going to be
+	// released in this collection
+	static void pruneRemembered();
+
+	// incremental marking
+	// -------------------
+	// when incrementalBudget is non zero, a collection only marks
+	// the roots, and then scans at most incrementalBudget gray
+	// objects on each allocation, until the gray list is empty.
+	// objects allocated in the meantime are white, and stores
+	// into already scanned objects are caught by writeBarrier.
+	// objects of types which are not covered by the barrier
+	// are remembered in rescanList, and scanned again along
+	// with the roots when the cycle finishes.
+	static size_t    incrementalBudget;
+	static bool      isMarking;
+	static GrayList *rescanList;
+	// when set, mark() pushes already marked objects to the
+	// gray list again, so that the roots are rescanned
+	static bool regrayMarked;
+	// increments gc_count, and decides the generations
+	// to collect
+	static void beginCycle();
+	static void startCycle();
+	static void step();
+	static void finishCycle(bool force);
+	static void setIncrementalBudget(size_t v);
+	// must be called when a reference 'v' is stored into
+	// 'holder', if holder is an Object, Array, Map, Set or
+	// a Tuple. records old to young references in the
+	// remembered set, and keeps the incremental marking
+	// invariant. defined in value.h.
+	static inline void writeBarrier(GcObject *holder, Value v);
+#define OBJTYPE(r, n) static inline void writeBarrier(r *holder, Value v);
+#include "objecttype.h"
+
+#ifdef GC_PARALLEL_MARK
+	// parallel marking
+	// ----------------
+	// drainAll() distributes the gray objects among
+	// markThreads work stealing deques, one for each
+	// marking thread, including the collecting thread.
+	static size_t markThreads;
+	static void   setMarkThreads(size_t n);
+	static void   parallelDrain();
+#endif
+
+	// number of pauses in each bucket
+	static size_t pauseHistogram[GC_PAUSE_HISTOGRAM_BUCKETS];
+
+	// telemetry
+	// ---------
+	// the counters are kept in all the builds, and are exposed
+	// to the scripts by gc_stats(). numCollections[i] counts
+	// the collections which swept generations 0 to i. the pause
+	// times are in microseconds, like the histogram.
+	static size_t numCollections[GC_NUM_GENERATIONS];
+	static size_t numPauses;
+	static size_t totalPause;
+	static size_t maxPause;
+	// number of objects and bytes allocated for each
+	// type so far, indexed by GcObject::Type
+	static size_t typeAllocations[];
+	static size_t typeAllocatedBytes[];
+	// state of the heap, which is computed on demand,
+	// since the generations have to be walked for it
+	struct Stats {
+		size_t objects[GC_NUM_GENERATIONS];
+		size_t bytes[GC_NUM_GENERATIONS];
+		// unmarked objects of the collected generations,
+		// which are not released yet
+		size_t unsweptObjects;
+		size_t unsweptBytes;
+		// bytes handed out from the pools of the memory
+		// manager, and the bytes of the pools in memory
+		size_t poolUsed;
+		size_t poolResident;
+		// bytes of the cached large spans in memory
+		size_t largeCacheResident;
+		size_t nurseryFreeBlocks;
+	};
+	static void stats(Stats &s);
+	// calls fn on each of the objects which are not known to
+	// be garbage, except the strings
+	static void walk(void (*fn)(GcObject *o, void *data), void *data);
+	// writes the counters and the stats as a JSON object.
+	// if NEXT_GC_STATS is set in the environment, they
+	// are written to that file when the program exits.
+	static void dumpStats(WritableStream &w);
+	// number of bytes an object occupies
+	static size_t sizeOf(GcObject *obj);
+
+	// nursery
+	// -------
+	// small objects are allocated by bumping a pointer in the
+	// current nursery block. objects are never moved, since
+	// their addresses are held all over the interpreter, so
+	// instead each block counts its live objects, and is
+	// reused as a whole once all of them are released. a
+	// block with long lived objects stays pinned until they
+	// die, and the allocations fall back to the memory
+	// manager when there are no free blocks left.
+	static char * nursery;
+	static char * nurseryTop;
+	static char * nurseryEnd;
+	static size_t nurseryCurrent;
+	static size_t nurseryLive[GC_NURSERY_BLOCKS];
+	// stack of blocks without any live objects
+	static size_t nurseryFree[GC_NURSERY_BLOCKS];
+	static size_t nurseryNumFree;
+	// returns nullptr if the object does not fit in the nursery
+	static void *nurseryAlloc(size_t bytes);
+	static bool  inNursery(void *mem) {
+#ifdef GC_USE_STD_ALLOC
+		(void)mem;
+		return false;
+#else
+		return (uintptr_t)mem - (uintptr_t)nursery <
+		       (uintptr_t)GC_NURSERY_BLOCK_SIZE * GC_NURSERY_BLOCKS;
+#endif
+	}
+	static void nurseryRelease(void *mem);
+
 	// replacement for manual allocations
 	// to keep track of allocated bytes
 	static void *malloc(size_t bytes);
@@ -214,16 +511,27 @@ struct Gc {
 	static void release(GcObject *obj);
 	static void release(Value v);
 	// clear
-	// sweep this particular generation
-	// unmarkedClassesHead holds the unmarked classes in a linked
-	// list to ensure that all of their objects have been released
-	// before they are released.
-	static void sweep(size_t genid, Class **unmarkedClassesHead);
+	// releases the object if it is not marked, otherwise
+	// moves it to gens[genid]. the unmarked classes are
+	// held in a linked list to ensure that all of their
+	// objects have been released before they are released.
+	static void sweep(GcObject *v, Generation **gens, size_t genid);
+	// sweeps this particular generation in place
+	static void sweep(Generation **gens, size_t genid);
 
 	// core gc method
 	// the flag forces a gc even if
 	// total_allocated < next_gc
 	static void gc(bool force = false);
+	// objects are never moved, since their addresses are held
+	// all over the interpreter, so instead of compacting the
+	// heap, this performs a full collection, releases the empty
+	// arenas, and gives the memory of the free pools of the rest
+	// back to the OS. returns the number of bytes given back.
+	// this is also done automatically after a collection, when
+	// the pools are sparsely populated.
+	static size_t compact();
+	static bool   fullCollection;
 	// sets next_gc
 	static void setNextGC(size_t v);
 	// sets max_gc
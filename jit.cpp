@@ -0,0 +1,1485 @@
+#include "jit.h"
+
+#ifdef NEXT_USE_JIT
+#include "engine.h"
+#include "gc.h"
+#include "objects/bytecode.h"
+#include "objects/class.h"
+#include "objects/fiber.h"
+#include "objects/function.h"
+#include "objects/iterator.h"
+#include "objects/object.h"
+#include "value.h"
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <sys/mman.h>
+#include <unistd.h>
+
+size_t Jit::threshold = 1000;
+
+void Jit::init() {
+	const char *t = std::getenv("NEXT_JIT_THRESHOLD");
+	if(t != nullptr)
+		threshold = std::strtoull(t, nullptr, 10);
+}
+
+namespace {
+
+const uint8_t *opcodeLengths = Bytecode::OpcodeLengths;
+
+enum Reg {
+	RAX,
+	RCX,
+	RDX,
+	RBX,
+	RSP,
+	RBP,
+	RSI,
+	RDI,
+	R8,
+	R9,
+	R10,
+	R11,
+	R12,
+	R13,
+	R14,
+	R15
+};
+
+// the state of the interpreter is kept in the callee saved
+// registers, so that it survives the calls to the helpers
+const Reg STACK  = RBX; // Stack, slots of the present frame
+const Reg TOP    = R12; // fiber->stackTop
+const Reg LOCALS = R13; // Locals, constants of the present frame
+const Reg FIBER  = R14;
+
+// the negation of a condition only differs in the lowest bit
+enum Cond {
+	CC_O  = 0x0,
+	CC_B  = 0x2,
+	CC_AE = 0x3,
+	CC_E  = 0x4,
+	CC_NE = 0x5,
+	CC_BE = 0x6,
+	CC_A  = 0x7,
+	CC_L  = 0xC,
+	CC_GE = 0xD,
+	CC_LE = 0xE,
+	CC_G  = 0xF
+};
+
+// encodes the handful of x86-64 instructions the templates use
+struct Assembler {
+	uint8_t *buf;
+	size_t   size;
+	size_t   capacity;
+
+	Assembler() : buf(nullptr), size(0), capacity(0) {}
+	~Assembler() { Gc_free(buf, capacity); }
+
+	void byte(uint8_t b) {
+		if(size == capacity) {
+			size_t newcap = capacity == 0 ? 1024 : capacity * 2;
+			buf           = (uint8_t *)Gc_realloc(buf, capacity, newcap);
+			capacity      = newcap;
+		}
+		buf[size++] = b;
+	}
+	void dword(uint32_t d) {
+		for(int i = 0; i < 4; i++) byte(d >> (i * 8));
+	}
+	void qword(uint64_t q) {
+		for(int i = 0; i < 8; i++) byte(q >> (i * 8));
+	}
+	void patch(size_t at, uint32_t d) { memcpy(buf + at, &d, 4); }
+
+	void rex(bool w, int reg, int base) {
+		uint8_t r = 0x40 | (w << 3) | ((reg >> 3) << 2) | (base >> 3);
+		if(r != 0x40)
+			byte(r);
+	}
+	// [base + disp]
+	void mem(int reg, int base, int32_t disp) {
+		bool disp8 = disp >= -128 && disp <= 127;
+		byte((disp8 ? 0x40 : 0x80) | ((reg & 7) << 3) | (base & 7));
+		if((base & 7) == RSP)
+			byte(0x24);
+		if(disp8)
+			byte(disp);
+		else
+			dword(disp);
+	}
+	void regreg(uint8_t op, Reg dst, Reg src) {
+		rex(true, src, dst);
+		byte(op);
+		byte(0xC0 | ((src & 7) << 3) | (dst & 7));
+	}
+
+	void load(Reg r, Reg base, int32_t disp) {
+		rex(true, r, base);
+		byte(0x8B);
+		mem(r, base, disp);
+	}
+	void store(Reg base, int32_t disp, Reg r) {
+		rex(true, r, base);
+		byte(0x89);
+		mem(r, base, disp);
+	}
+	void cmpMem(Reg r, Reg base, int32_t disp) {
+		rex(true, r, base);
+		byte(0x3B);
+		mem(r, base, disp);
+	}
+	// add qword [base + disp], imm8
+	void addMemImm(Reg base, int32_t disp, int8_t imm) {
+		rex(true, 0, base);
+		byte(0x83);
+		mem(0, base, disp);
+		byte(imm);
+	}
+	// cmp [base + disp], imm, on a qword if wide, on a dword otherwise
+	void cmpMemImm(bool wide, Reg base, int32_t disp, int32_t imm) {
+		rex(wide, 0, base);
+		byte(0x81);
+		mem(7, base, disp);
+		dword(imm);
+	}
+	void mov(Reg dst, Reg src) { regreg(0x89, dst, src); }
+	void add(Reg dst, Reg src) { regreg(0x01, dst, src); }
+	void sub(Reg dst, Reg src) { regreg(0x29, dst, src); }
+	void andReg(Reg dst, Reg src) { regreg(0x21, dst, src); }
+	void cmp(Reg a, Reg b) { regreg(0x39, a, b); }
+	void test(Reg a, Reg b) { regreg(0x85, a, b); }
+	void imul(Reg dst, Reg src) {
+		rex(true, dst, src);
+		byte(0x0F), byte(0xAF), byte(0xC0 | ((dst & 7) << 3) | (src & 7));
+	}
+	void neg(Reg r) {
+		rex(true, 0, r);
+		byte(0xF7), byte(0xD8 | (r & 7));
+	}
+	// shl and sar r, imm
+	void shl(Reg r, uint8_t n) {
+		rex(true, 0, r);
+		byte(0xC1), byte(0xE0 | (r & 7)), byte(n);
+	}
+	void sar(Reg r, uint8_t n) {
+		rex(true, 0, r);
+		byte(0xC1), byte(0xF8 | (r & 7)), byte(n);
+	}
+	void movImm(Reg r, uint64_t v) {
+		if(v <= 0xFFFFFFFF) {
+			// zero extended
+			rex(false, 0, r);
+			byte(0xB8 + (r & 7));
+			dword(v);
+		} else {
+			rex(true, 0, r);
+			byte(0xB8 + (r & 7));
+			qword(v);
+		}
+	}
+	// op r, imm with the given /digit
+	void aluImm(int digit, Reg r, int32_t v) {
+		rex(true, 0, r);
+		if(v >= -128 && v <= 127) {
+			byte(0x83);
+			byte(0xC0 | (digit << 3) | (r & 7));
+			byte(v);
+		} else {
+			byte(0x81);
+			byte(0xC0 | (digit << 3) | (r & 7));
+			dword(v);
+		}
+	}
+	void addImm(Reg r, int32_t v) { aluImm(0, r, v); }
+	void orImm(Reg r, int32_t v) { aluImm(1, r, v); }
+	void andImm(Reg r, int32_t v) { aluImm(4, r, v); }
+	void subImm(Reg r, int32_t v) { aluImm(5, r, v); }
+	void cmpImm(Reg r, int32_t v) { aluImm(7, r, v); }
+	// test the low byte of r against imm
+	void testLow(Reg r, uint8_t imm) {
+		// spl, bpl, sil and dil also need a rex prefix
+		if(r >= R8)
+			byte(0x41);
+		else if(r >= RSP)
+			byte(0x40);
+		byte(0xF6);
+		byte(0xC0 | (r & 7));
+		byte(imm);
+	}
+	// returns the position of the rel32 to patch
+	size_t jcc(Cond c) {
+		byte(0x0F);
+		byte(0x80 | c);
+		dword(0);
+		return size - 4;
+	}
+	size_t jmp() {
+		byte(0xE9);
+		dword(0);
+		return size - 4;
+	}
+	// points the rel32 at 'at' to 'target'
+	void link(size_t at, size_t target) { patch(at, target - (at + 4)); }
+	void bind(size_t at) { link(at, size); }
+
+	void setcc(Cond c) { // al
+		byte(0x0F);
+		byte(0x90 | c);
+		byte(0xC0);
+	}
+	// converts the flag in al to a boolean Value in rax
+	void boolean() {
+		byte(0x0F), byte(0xB6), byte(0xC0); // movzx eax, al
+		byte(0xC1), byte(0xE0), byte(0x03); // shl eax, 3
+		byte(0x83), byte(0xC8), byte(0x06); // or eax, 6
+	}
+	void movqToXmm(int x, Reg r) {
+		byte(0x66);
+		rex(true, x, r);
+		byte(0x0F), byte(0x6E), byte(0xC0 | (x << 3) | (r & 7));
+	}
+	void movqFromXmm(Reg r, int x) {
+		byte(0x66);
+		rex(true, x, r);
+		byte(0x0F), byte(0x7E), byte(0xC0 | (x << 3) | (r & 7));
+	}
+	// addsd, subsd, mulsd, divsd xmm0, xmm1
+	enum { ADDSD = 0x58, MULSD = 0x59, SUBSD = 0x5C, DIVSD = 0x5E };
+	void sse(uint8_t op) { byte(0xF2), byte(0x0F), byte(op), byte(0xC1); }
+	void ucomisd(int a, int b) {
+		byte(0x66), byte(0x0F), byte(0x2E), byte(0xC0 | (a << 3) | b);
+	}
+	// cvtsi2sd xmm, r
+	void cvtsi2sd(int x, Reg r) {
+		byte(0xF2);
+		rex(true, x, r);
+		byte(0x0F), byte(0x2A), byte(0xC0 | (x << 3) | (r & 7));
+	}
+	void call(Reg r) {
+		rex(false, 0, r);
+		byte(0xFF), byte(0xD0 | (r & 7));
+	}
+	void jmp(Reg r) {
+		rex(false, 0, r);
+		byte(0xFF), byte(0xE0 | (r & 7));
+	}
+	void push(Reg r) {
+		rex(false, 0, r);
+		byte(0x50 + (r & 7));
+	}
+	void pop(Reg r) {
+		rex(false, 0, r);
+		byte(0x58 + (r & 7));
+	}
+	void ret() { byte(0xC3); }
+	// flips the sign bit of a double
+	void btcSign(Reg r) {
+		rex(true, 0, r);
+		byte(0x0F), byte(0xBA), byte(0xF8 | (r & 7)), byte(63);
+	}
+};
+
+const int32_t fiberStackTop = offsetof(Fiber, stackTop);
+const int32_t fiberFrame    = offsetof(Fiber, callFramePointer);
+// the present frame is right below callFramePointer
+const int32_t frameSize = sizeof(Fiber::CallFrame);
+const int32_t frameStack =
+    (int32_t)offsetof(Fiber::CallFrame, stack_) - frameSize;
+const int32_t frameLocals =
+    (int32_t)offsetof(Fiber::CallFrame, locals) - frameSize;
+const int32_t objectSlots = sizeof(Object);
+// the values is_falsey of engine.cpp holds for, including a
+// zero double, which equals ValueZero
+const uint64_t falsey[] = {ValueNil.val.value, ValueFalse.val.value,
+                           ValueZero.val.value, 0x1};
+
+// helpers called by the compiled code
+
+void writeBarrier(GcObject *holder, uint64_t v) {
+	Gc::writeBarrier(holder, Value(Value::ValueUnion(v)));
+}
+
+// the helpers performing calls and returns return either
+// the native address to continue from in the new frame,
+// or one of these
+const uintptr_t NOT_PERFORMED = 0; // exit at the instruction
+const uintptr_t NOT_COMPILED  = 1; // exit to the new frame
+const uintptr_t THREW         = 2; // exit to the error handler
+const uintptr_t RETURNED      = 3; // continue after the call
+
+uintptr_t callMethod(Fiber *fiber, Value *stackTop, Function *f, int numArgs,
+                     Bytecode::Opcode *ip, bool soft) {
+	// the call may have been patched to a builtin since
+	if(f->getType() != Function::METHOD)
+		return NOT_PERFORMED;
+	// a soft call is a constructor call, whose receiver is
+	// created by 'construct'
+	if(soft)
+		stackTop[-numArgs - 1] = ValueNil;
+	fiber->stackTop                = stackTop;
+	fiber->getCurrentFrame()->code = ip;
+	fiber->appendMethodNoBuiltin(f, numArgs, false);
+	void *entry = nullptr;
+	if(Jit::hot(f->code))
+		entry = Jit::entry(f->code, f->code->bytecodes);
+	return entry ? (uintptr_t)entry : NOT_COMPILED;
+}
+
+uintptr_t returnFrom(Fiber *fiber, Value *stackTop) {
+	// let the engine return from execute(), or to
+	// the parent fiber
+	if(fiber->getCurrentFrame()->returnToCaller ||
+	   fiber->callFrameCount() < 2)
+		return NOT_PERFORMED;
+	Value v = stackTop[-1];
+	fiber->popFrame();
+	*fiber->stackTop++ = v;
+	// continue from the instruction after the call
+	Fiber::CallFrame *caller = fiber->getCurrentFrame();
+	caller->code++;
+	void *entry = Jit::entry(caller->f->code, caller->code);
+	return entry ? (uintptr_t)entry : NOT_COMPILED;
+}
+
+uintptr_t callBuiltin(Fiber *fiber, Value *stackTop, Function *f, int numArgs,
+                      Bytecode::Opcode *ip) {
+	if(f->getType() != Function::BUILTIN)
+		return NOT_PERFORMED;
+	fiber->stackTop                = stackTop;
+	fiber->getCurrentFrame()->code = ip;
+	Value res = f->func(stackTop - numArgs - 1, numArgs + 1);
+	fiber->stackTop -= numArgs + 1;
+	if(ExecutionEngine::hasPendingExceptions())
+		return THREW;
+	// it may have switched the fiber
+	Fiber *current       = ExecutionEngine::getCurrentFiber();
+	*current->stackTop++ = res;
+	if(current != fiber) {
+		current->getCurrentFrame()->code++;
+		return NOT_COMPILED;
+	}
+	return RETURNED;
+}
+
+// calls the function of a polymorphic or a megamorphic call
+// site, whose type is only known at runtime
+uintptr_t callFunction(Fiber *fiber, Value *stackTop, Function *f,
+                       int numArgs, Bytecode::Opcode *ip) {
+	if(f->getType() == Function::METHOD)
+		return callMethod(fiber, stackTop, f, numArgs, ip, false);
+	return callBuiltin(fiber, stackTop, f, numArgs, ip);
+}
+
+Function *lookupMethod(uint64_t receiver, int sym) {
+	return ExecutionEngine::lookupMethod(
+	    Value(Value::ValueUnion(receiver)).getClass(), sym);
+}
+
+void construct(Value *stack, Class *c) {
+	Object *o = Gc::allocObject(c);
+	stack[0]  = Value(o);
+	if(c->module == NULL)
+		c->instance = o;
+}
+
+uint64_t loadModule(Value *stack, bool super) {
+	Value klass = stack[0];
+	// the 0th slot may also contain an object
+	if(!klass.isClass())
+		klass = klass.getClass();
+	Class *c = klass.toClass();
+	return Value((super ? c->superclass : c)->module->instance).val.value;
+}
+
+// returns false if the iterator is exhausted
+#define ITERATOR(x, y)                                    \
+	bool iterateNext##x(Value *stackTop) {                \
+		x##Iterator *it = stackTop[-1].to##x##Iterator(); \
+		if(!it->hasNext.toBoolean())                      \
+			return false;                                 \
+		stackTop[-1] = it->Next();                        \
+		return true;                                      \
+	}
+#include "objects/iterator_types.h"
+
+struct Compiler {
+	Bytecode *b;
+	Assembler as;
+	// native offset of each instruction
+	size_t *native;
+	// whether the instruction has a template
+	bool *compiled;
+	// jumps to instructions, linked once all are emitted
+	struct Fixup {
+		size_t at;
+		size_t target;
+		bool   exit; // to the exit stub of the instruction
+	};
+	Fixup *fixups;
+	size_t numFixups, fixupCapacity;
+	// shared stubs
+	size_t epilogue, switched, thrown;
+
+	Compiler(Bytecode *code)
+	    : b(code), fixups(nullptr), numFixups(0), fixupCapacity(0) {
+		native   = (size_t *)Gc_malloc(sizeof(size_t) * (b->size + 1));
+		compiled = (bool *)Gc_malloc(sizeof(bool) * (b->size + 1));
+		memset(compiled, 0, sizeof(bool) * (b->size + 1));
+	}
+	~Compiler() {
+		Gc_free(native, sizeof(size_t) * (b->size + 1));
+		Gc_free(compiled, sizeof(bool) * (b->size + 1));
+		Gc_free(fixups, sizeof(Fixup) * fixupCapacity);
+	}
+
+	void fixup(size_t at, size_t target, bool exit) {
+		if(numFixups == fixupCapacity) {
+			size_t newcap = fixupCapacity == 0 ? 64 : fixupCapacity * 2;
+			fixups        = (Fixup *)Gc_realloc(fixups,
+                                         sizeof(Fixup) * fixupCapacity,
+                                         sizeof(Fixup) * newcap);
+			fixupCapacity = newcap;
+		}
+		fixups[numFixups++] = {at, target, exit};
+	}
+	// jumps to the instruction at 'target'
+	void jumpTo(size_t target) { fixup(as.jmp(), target, false); }
+	void jumpTo(Cond c, size_t target) { fixup(as.jcc(c), target, false); }
+	// exits to the interpreter at the instruction at 'ip'
+	void exitTo(Cond c, size_t ip) { fixup(as.jcc(c), ip, true); }
+	void exitNow(size_t ip) {
+		as.movImm(RAX, ip);
+		as.link(as.jmp(), epilogue);
+	}
+
+	int operand(size_t ip) { return (int)b->bytecodes[ip]; }
+
+	// operands of the binary templates
+	struct Operand {
+		enum Kind { SLOT, TOS, CONSTANT } kind;
+		int64_t value; // slot, depth from the top, or the bits
+	};
+	Operand slot(size_t ip) { return {Operand::SLOT, operand(ip)}; }
+	Operand tos(int depth) { return {Operand::TOS, depth}; }
+	// constants of the fused opcodes are always numbers
+	Operand constant(size_t ip) {
+		return {Operand::CONSTANT,
+		        (int64_t)b->values[operand(ip)].val.value};
+	}
+	Operand one() { return {Operand::CONSTANT, (int64_t)Value(1).val.value}; }
+	static Value constantOf(Operand o) {
+		return Value(Value::ValueUnion((uint64_t)o.value));
+	}
+	// whether the operand may hold a small integer
+	static bool maybeInteger(Operand o) {
+		return o.kind != Operand::CONSTANT || constantOf(o).isSmallInteger();
+	}
+
+	void load(Reg r, Operand o) {
+		switch(o.kind) {
+			case Operand::SLOT: as.load(r, STACK, o.value * 8); break;
+			case Operand::TOS: as.load(r, TOP, -o.value * 8); break;
+			case Operand::CONSTANT: as.movImm(r, o.value); break;
+		}
+	}
+	// returns the jump taken if r does not hold a small integer.
+	// clobbers rdx.
+	size_t notInteger(Reg r) {
+		as.mov(RDX, r);
+		as.andImm(RDX, 0xF);
+		as.cmpImm(RDX, 0xA);
+		return as.jcc(CC_NE);
+	}
+	// returns the jump taken if the integer in r, or the tagged
+	// one if 'tagged', does not fit in a small integer. clobbers
+	// rsi.
+	size_t notSmall(Reg r, bool tagged = false) {
+		as.mov(RSI, r);
+		as.shl(RSI, tagged ? 6 : 10);
+		as.sar(RSI, tagged ? 6 : 10);
+		as.cmp(RSI, r);
+		return as.jcc(CC_NE);
+	}
+	// tags the small integer in r
+	void tagInteger(Reg r) {
+		as.shl(r, 4);
+		as.orImm(r, 0xA);
+	}
+	// jumps to the small integer path of the binary templates
+	// if both of the operands in rax and rcx are small integers,
+	// and records the jumps to the double path otherwise
+	struct Paths {
+		size_t toDouble[2];
+		int    count;
+	};
+	Paths integers(Operand left, Operand right) {
+		Paths p;
+		p.count = 0;
+		if(left.kind != Operand::CONSTANT)
+			p.toDouble[p.count++] = notInteger(RAX);
+		if(right.kind != Operand::CONSTANT)
+			p.toDouble[p.count++] = notInteger(RCX);
+		return p;
+	}
+	void bind(const Paths &p) {
+		for(int i = 0; i < p.count; i++) as.bind(p.toDouble[i]);
+	}
+
+	// moves the double in r, loaded from the operand, to xmm x.
+	// clobbers r.
+	void untagDouble(int x, Reg r, Operand o) {
+		if(o.kind == Operand::CONSTANT) {
+			double   d = constantOf(o).toNumber();
+			uint64_t bits;
+			memcpy(&bits, &d, sizeof(bits));
+			as.movImm(r, bits);
+		} else {
+			as.andImm(r, -2);
+		}
+		as.movqToXmm(x, r);
+	}
+	// converts the number in r, loaded from the operand, to a
+	// double in xmm x, and exits at 'ip' if it is not a number.
+	// clobbers r and rdx.
+	void toDouble(int x, Reg r, Operand o, size_t ip) {
+		if(o.kind == Operand::CONSTANT) {
+			untagDouble(x, r, o);
+			return;
+		}
+		as.testLow(r, 1);
+		size_t isDouble = as.jcc(CC_NE);
+		fixup(notInteger(r), ip, true);
+		as.sar(r, 4);
+		as.cvtsi2sd(x, r);
+		size_t next = as.jmp();
+		as.bind(isDouble);
+		untagDouble(x, r, o);
+		as.bind(next);
+	}
+	// jumps to the double path of the arithmetic if both of the
+	// operands in rax and rcx are doubles, and returns the jump
+	// taken otherwise. clobbers rdx.
+	size_t notDoubles(Operand left, Operand right) {
+		if(left.kind == Operand::CONSTANT) {
+			as.testLow(RCX, 1);
+		} else if(right.kind == Operand::CONSTANT) {
+			as.testLow(RAX, 1);
+		} else {
+			as.mov(RDX, RAX);
+			as.andReg(RDX, RCX);
+			as.testLow(RDX, 1);
+		}
+		return as.jcc(CC_E);
+	}
+	// whether the operand may hold a double
+	static bool maybeDouble(Operand o) {
+		return o.kind != Operand::CONSTANT || constantOf(o).isDouble();
+	}
+	// loads the operands to xmm0 and xmm1
+	void doubles(Operand left, Operand right, size_t ip) {
+		toDouble(0, RAX, left, ip);
+		toDouble(1, RCX, right, ip);
+	}
+	// tags the double in xmm0 as a Value in rax. integral
+	// results are left as doubles, see value.h.
+	void tagDouble() {
+		as.movqFromXmm(RAX, 0);
+		as.orImm(RAX, 1);
+	}
+	static int pops(Operand o) { return o.kind == Operand::TOS; }
+
+	// the result replaces the operands on the stack
+	void result(Operand left, Operand right) {
+		int p = pops(left) + pops(right);
+		as.store(TOP, -p * 8, RAX);
+		if(p != 1)
+			as.addImm(TOP, (1 - p) * 8);
+	}
+
+	// 'op' is the sse opcode of the operation on doubles. two
+	// doubles are tried first, unless the interpreter has seen
+	// two small integers there, then two small integers, which
+	// are added, subtracted and multiplied as integers unless
+	// the result overflows. the rest are converted to doubles.
+	void arithmetic(uint8_t op, Operand left, Operand right, size_t ip,
+	                bool integer = false) {
+		load(RAX, left);
+		load(RCX, right);
+		size_t done[2];
+		int    numDone = 0;
+		if(!integer && maybeDouble(left) && maybeDouble(right) &&
+		   (left.kind != Operand::CONSTANT ||
+		    right.kind != Operand::CONSTANT)) {
+			size_t notDouble = notDoubles(left, right);
+			untagDouble(0, RAX, left);
+			untagDouble(1, RCX, right);
+			as.sse(op);
+			tagDouble();
+			done[numDone++] = as.jmp();
+			as.bind(notDouble);
+		}
+		if(op != Assembler::DIVSD && maybeInteger(left) &&
+		   maybeInteger(right)) {
+			Paths  p        = integers(left, right);
+			size_t overflow = 0;
+			// the sum and the difference of the tagged integers
+			// are tagged too
+			switch(op) {
+				case Assembler::ADDSD:
+					as.mov(RDX, RAX);
+					as.add(RDX, RCX);
+					as.subImm(RDX, 0xA);
+					break;
+				case Assembler::SUBSD:
+					as.mov(RDX, RAX);
+					as.sub(RDX, RCX);
+					as.addImm(RDX, 0xA);
+					break;
+				default:
+					as.mov(RDX, RAX);
+					as.sar(RDX, 4);
+					as.mov(RSI, RCX);
+					as.sar(RSI, 4);
+					as.imul(RDX, RSI);
+					overflow = as.jcc(CC_O);
+					break;
+			}
+			size_t big = notSmall(RDX, op != Assembler::MULSD);
+			if(op == Assembler::MULSD)
+				tagInteger(RDX);
+			as.mov(RAX, RDX);
+			done[numDone++] = as.jmp();
+			// the double path computes it again
+			bind(p);
+			if(overflow)
+				as.bind(overflow);
+			as.bind(big);
+		}
+		doubles(left, right, ip);
+		as.sse(op);
+		tagDouble();
+		for(int i = 0; i < numDone; i++) as.bind(done[i]);
+		result(left, right);
+	}
+
+	// sets the flags so that 'cond' is true if the comparison
+	// holds. unordered operands clear all of them.
+	static Cond compareFlags(Bytecode::Opcode base, bool &swap) {
+		switch(base) {
+			case Bytecode::CODE_less: swap = true; return CC_A;
+			case Bytecode::CODE_lesseq: swap = true; return CC_AE;
+			case Bytecode::CODE_greater: swap = false; return CC_A;
+			default: swap = false; return CC_AE;
+		}
+	}
+	// the condition of the comparison on two small integers.
+	// the tags keep their order, so they are compared as is.
+	static Cond integerFlags(Bytecode::Opcode base) {
+		switch(base) {
+			case Bytecode::CODE_less: return CC_L;
+			case Bytecode::CODE_lesseq: return CC_LE;
+			case Bytecode::CODE_greater: return CC_G;
+			default: return CC_GE;
+		}
+	}
+	static Cond negate(Cond c) { return (Cond)(c ^ 1); }
+	void compare(Bytecode::Opcode base, Operand left, Operand right,
+	             size_t ip) {
+		load(RAX, left);
+		load(RCX, right);
+		bool   integer = maybeInteger(left) && maybeInteger(right);
+		size_t done    = 0;
+		if(integer) {
+			Paths p = integers(left, right);
+			as.cmp(RAX, RCX);
+			as.setcc(integerFlags(base));
+			as.boolean();
+			done = as.jmp();
+			bind(p);
+		}
+		bool swap;
+		Cond c = compareFlags(base, swap);
+		doubles(left, right, ip);
+		swap ? as.ucomisd(1, 0) : as.ucomisd(0, 1);
+		as.setcc(c);
+		as.boolean();
+		if(integer)
+			as.bind(done);
+		result(left, right);
+	}
+	// the fused comparison at ip, followed by a jumpiffalse
+	bool compareJump(Bytecode::Opcode base, Operand left, Operand right,
+	                 size_t ip) {
+		size_t jif = ip + opcodeLengths[b->bytecodes[ip]];
+		if(b->bytecodes[jif] != Bytecode::CODE_jumpiffalse)
+			return false;
+		size_t target = jif + operand(jif + 1);
+		int    p      = pops(left) + pops(right);
+		load(RAX, left);
+		load(RCX, right);
+		if(maybeInteger(left) && maybeInteger(right)) {
+			Paths paths = integers(left, right);
+			if(p)
+				as.subImm(TOP, p * 8);
+			as.cmp(RAX, RCX);
+			// jump unless the comparison holds
+			jumpTo(negate(integerFlags(base)), target);
+			jumpTo(jif + 2);
+			bind(paths);
+		}
+		bool swap;
+		Cond c = compareFlags(base, swap);
+		doubles(left, right, ip);
+		if(p)
+			as.subImm(TOP, p * 8);
+		swap ? as.ucomisd(1, 0) : as.ucomisd(0, 1);
+		// unordered operands jump too
+		jumpTo(negate(c), target);
+		jumpTo(jif + 2);
+		return true;
+	}
+
+	// jumps to 'target' if rax is falsey
+	void jumpIfFalsey(size_t target) {
+		for(uint64_t f : falsey) {
+			as.cmpImm(RAX, f);
+			jumpTo(CC_E, target);
+		}
+	}
+	// jumps to 'target' if rax is not falsey
+	void jumpIfTruthy(size_t target) {
+		size_t isFalsey[4];
+		for(int i = 0; i < 4; i++) {
+			as.cmpImm(RAX, falsey[i]);
+			isFalsey[i] = as.jcc(CC_E);
+		}
+		jumpTo(target);
+		for(size_t j : isFalsey) as.bind(j);
+	}
+
+	void push(Reg r) {
+		as.store(TOP, 0, r);
+		as.addImm(TOP, 8);
+	}
+
+	// calls a helper, with the stack top stored in the fiber
+	void callHelper(void *fn) {
+		as.store(FIBER, fiberStackTop, TOP);
+		as.movImm(RAX, (uintptr_t)fn);
+		as.call(RAX);
+	}
+	// counts a call resolved from the cache at Locals[idx]
+	void countHit(int idx) {
+		as.addMemImm(LOCALS, (idx + Bytecode::CallCacheHits) * 8, 1 << 4);
+	}
+	// handles the result of callMethod/returnFrom. the call is
+	// counted as a hit of the cache at Locals[cache] once it
+	// is performed.
+	void switchTo(size_t ip, int cache = -1) {
+		as.test(RAX, RAX);
+		exitTo(CC_E, ip);
+		if(cache >= 0)
+			countHit(cache);
+		enterFrame();
+	}
+	// continues from rax, which is the native address of the
+	// new frame, or NOT_COMPILED
+	void enterFrame() {
+		as.cmpImm(RAX, NOT_COMPILED);
+		as.link(as.jcc(CC_E), switched);
+		// continue from rax in the new frame. each call and ret
+		// has its own indirect jump, which predicts far better
+		// than a shared one.
+		as.load(TOP, FIBER, fiberStackTop);
+		as.load(RCX, FIBER, fiberFrame);
+		as.load(STACK, RCX, frameStack);
+		as.load(LOCALS, RCX, frameLocals);
+		as.jmp(RAX);
+	}
+
+	void prologue() {
+		// int64_t (Value *stack, Fiber *fiber, Value *locals, void *entry)
+		as.push(RBX), as.push(R12), as.push(R13), as.push(R14), as.push(R15);
+		as.mov(STACK, RDI);
+		as.mov(FIBER, RSI);
+		as.mov(LOCALS, RDX);
+		as.load(TOP, FIBER, fiberStackTop);
+		as.jmp(RCX);
+		// rax holds the value to return
+		epilogue = as.size;
+		as.store(FIBER, fiberStackTop, TOP);
+		as.pop(R15), as.pop(R14), as.pop(R13), as.pop(R12), as.pop(RBX);
+		as.ret();
+		// a helper has switched the frame, which is not compiled
+		switched = as.size;
+		as.load(TOP, FIBER, fiberStackTop);
+		as.movImm(RAX, (uint64_t)Jit::SWITCHED);
+		as.link(as.jmp(), epilogue);
+		// a builtin has thrown
+		thrown = as.size;
+		as.load(TOP, FIBER, fiberStackTop);
+		as.movImm(RAX, (uint64_t)Jit::THROWN);
+		as.link(as.jmp(), epilogue);
+	}
+
+	// the engine patches some of the instructions in place, and
+	// the template of those is only valid for the instruction
+	// it was compiled from. exits at 'ip' if it has been patched.
+	void checkPatched(size_t ip) {
+		uint64_t words;
+		memcpy(&words, b->bytecodes + ip, sizeof(words));
+		as.movImm(RAX, (uintptr_t)(b->bytecodes + ip));
+		as.movImm(RCX, words);
+		as.cmpMem(RCX, RAX, 0);
+		exitTo(CC_NE, ip);
+		if(opcodeLengths[b->bytecodes[ip]] == 3) {
+			as.cmpMemImm(false, RAX, 8, operand(ip + 2));
+			exitTo(CC_NE, ip);
+		}
+	}
+
+	// loads the class of the value in 'value' to rdx
+	void classOf(Reg value) {
+		as.movImm(RDX, (uintptr_t)Value::NumberClass);
+		as.testLow(value, 1);
+		size_t number = as.jcc(CC_NE);
+		as.testLow(value, 3);
+		size_t object = as.jcc(CC_E);
+		// otherwise it is either a small integer, nil or a
+		// boolean. only the booleans have the third bit set.
+		as.testLow(value, 4);
+		size_t boolean = as.jcc(CC_NE);
+		as.cmpImm(value, ValueNil.val.value);
+		size_t integer = as.jcc(CC_NE);
+		as.movImm(RDX, (uintptr_t)Value::NilClass);
+		size_t nil = as.jmp();
+		as.bind(boolean);
+		as.movImm(RDX, (uintptr_t)Value::BooleanClass);
+		size_t done = as.jmp();
+		as.bind(object);
+		as.load(RDX, value, 0);
+		as.bind(number), as.bind(integer), as.bind(nil), as.bind(done);
+	}
+	// exits at 'ip' unless 'value' is an object of the class
+	// cached at Locals[idx]
+	void checkObjectClass(Reg value, int idx, size_t ip) {
+		as.testLow(value, 3);
+		exitTo(CC_NE, ip);
+		as.load(RDX, value, 0);
+		as.cmpMem(RDX, LOCALS, idx * 8);
+		exitTo(CC_NE, ip);
+	}
+
+	// loads the address of the slot of the object in 'value'
+	// to rcx, from the (class, slot) pairs cached at
+	// Locals[idx]. exits at 'ip' if none of them matches.
+	void fieldSlot(Reg value, int idx, size_t ip) {
+		as.testLow(value, 3);
+		exitTo(CC_NE, ip);
+		as.load(RDX, value, 0);
+		size_t found[Bytecode::FieldCacheSize];
+		for(int i = 0; i < Bytecode::FieldCacheSize; i++) {
+			as.cmpMem(RDX, LOCALS, (idx + 2 * i) * 8);
+			size_t next = as.jcc(CC_NE);
+			as.load(RCX, LOCALS, (idx + 2 * i + 1) * 8);
+			found[i] = as.jmp();
+			as.bind(next);
+		}
+		fixup(as.jmp(), ip, true);
+		for(size_t f : found) as.bind(f);
+		// the slots are small integers
+		as.sar(RCX, 4);
+		as.shl(RCX, 3);
+		as.add(RCX, value);
+	}
+
+	// emits the template of the instruction at ip, returns
+	// false if it has none
+	bool emit(size_t ip);
+
+	Jit::Code *compile();
+};
+
+bool Compiler::emit(size_t ip) {
+	Bytecode::Opcode op = b->bytecodes[ip];
+	switch(op) {
+#define LOAD_SLOT(n)                        \
+	case Bytecode::CODE_load_slot_##n:      \
+		as.load(RAX, STACK, n * 8);         \
+		push(RAX);                          \
+		return true;                        \
+	case Bytecode::CODE_store_slot_##n:     \
+		as.load(RAX, TOP, -8);              \
+		as.store(STACK, n * 8, RAX);        \
+		return true;                        \
+	case Bytecode::CODE_store_slot_pop_##n: \
+		as.subImm(TOP, 8);                  \
+		as.load(RAX, TOP, 0);               \
+		as.store(STACK, n * 8, RAX);        \
+		return true;
+		LOAD_SLOT(0)
+		LOAD_SLOT(1)
+		LOAD_SLOT(2)
+		LOAD_SLOT(3)
+		LOAD_SLOT(4)
+		LOAD_SLOT(5)
+		LOAD_SLOT(6)
+		LOAD_SLOT(7)
+#undef LOAD_SLOT
+		case Bytecode::CODE_load_slot:
+			as.load(RAX, STACK, operand(ip + 1) * 8);
+			push(RAX);
+			return true;
+		case Bytecode::CODE_store_slot:
+			as.load(RAX, TOP, -8);
+			as.store(STACK, operand(ip + 1) * 8, RAX);
+			return true;
+		case Bytecode::CODE_store_slot_pop:
+			as.subImm(TOP, 8);
+			as.load(RAX, TOP, 0);
+			as.store(STACK, operand(ip + 1) * 8, RAX);
+			return true;
+		case Bytecode::CODE_push:
+			as.load(RAX, LOCALS, operand(ip + 1) * 8);
+			push(RAX);
+			return true;
+		case Bytecode::CODE_pushn:
+			as.movImm(RAX, ValueNil.val.value);
+			push(RAX);
+			return true;
+		case Bytecode::CODE_pop: as.subImm(TOP, 8); return true;
+
+		case Bytecode::CODE_load_object_slot:
+			as.load(RAX, STACK, 0);
+			as.load(RAX, RAX, objectSlots + operand(ip + 1) * 8);
+			push(RAX);
+			return true;
+		case Bytecode::CODE_load_tos_slot:
+			as.load(RAX, TOP, -8);
+			as.load(RAX, RAX, objectSlots + operand(ip + 1) * 8);
+			as.store(TOP, -8, RAX);
+			return true;
+		case Bytecode::CODE_store_object_slot:
+		case Bytecode::CODE_store_object_slot_pop:
+			as.load(RDI, STACK, 0);
+			as.load(RSI, TOP, -8);
+			as.store(RDI, objectSlots + operand(ip + 1) * 8, RSI);
+			if(op == Bytecode::CODE_store_object_slot_pop)
+				as.subImm(TOP, 8);
+			callHelper((void *)writeBarrier);
+			return true;
+		case Bytecode::CODE_store_tos_slot:
+			as.subImm(TOP, 8);
+			as.load(RDI, TOP, 0);
+			as.load(RSI, TOP, -8);
+			as.store(RDI, objectSlots + operand(ip + 1) * 8, RSI);
+			callHelper((void *)writeBarrier);
+			return true;
+
+		case Bytecode::CODE_jump: jumpTo(ip + operand(ip + 1)); return true;
+		case Bytecode::CODE_jumpiffalse:
+			as.subImm(TOP, 8);
+			as.load(RAX, TOP, 0);
+			jumpIfFalsey(ip + operand(ip + 1));
+			return true;
+		case Bytecode::CODE_jumpiftrue:
+			as.subImm(TOP, 8);
+			as.load(RAX, TOP, 0);
+			jumpIfTruthy(ip + operand(ip + 1));
+			return true;
+		case Bytecode::CODE_land:
+			as.load(RAX, TOP, -8);
+			jumpIfFalsey(ip + operand(ip + 1));
+			as.subImm(TOP, 8);
+			return true;
+		case Bytecode::CODE_lor:
+			as.load(RAX, TOP, -8);
+			jumpIfTruthy(ip + operand(ip + 1));
+			as.subImm(TOP, 8);
+			return true;
+#define ITERATOR(x, y)                                   \
+	case Bytecode::CODE_iterate_next_builtin_##x:        \
+		checkPatched(ip);                                \
+		as.mov(RDI, TOP);                                \
+		callHelper((void *)iterateNext##x);              \
+		as.testLow(RAX, 0xFF);                           \
+		jumpTo(CC_NE, ip + 2);                           \
+		as.subImm(TOP, 8);                               \
+		jumpTo(ip + operand(ip + 1));                    \
+		return true;
+#include "objects/iterator_types.h"
+		case Bytecode::CODE_iterator_verify:
+			as.load(RAX, TOP, -8);
+			classOf(RAX);
+			as.cmpMem(RDX, LOCALS, operand(ip + 1) * 8);
+			exitTo(CC_NE, ip);
+			return true;
+
+		case Bytecode::CODE_load_field_slot:
+			checkPatched(ip);
+			as.load(RAX, TOP, -8);
+			checkObjectClass(RAX, operand(ip + 1), ip);
+			as.load(RAX, RAX, objectSlots + operand(ip + 2) * 8);
+			as.store(TOP, -8, RAX);
+			// skip the load_field that follows
+			jumpTo(ip + 5);
+			return true;
+		case Bytecode::CODE_store_field_slot:
+			checkPatched(ip);
+			as.load(RDI, TOP, -8);
+			checkObjectClass(RDI, operand(ip + 1), ip);
+			as.subImm(TOP, 8);
+			as.load(RSI, TOP, -8);
+			as.store(RDI, objectSlots + operand(ip + 2) * 8, RSI);
+			callHelper((void *)writeBarrier);
+			// skip the store_field that follows
+			jumpTo(ip + 5);
+			return true;
+		case Bytecode::CODE_load_field_poly:
+			as.load(RAX, TOP, -8);
+			fieldSlot(RAX, operand(ip + 1), ip);
+			as.load(RAX, RCX, objectSlots);
+			as.store(TOP, -8, RAX);
+			jumpTo(ip + 5);
+			return true;
+		case Bytecode::CODE_store_field_poly:
+			as.load(RDI, TOP, -8);
+			fieldSlot(RDI, operand(ip + 1), ip);
+			as.subImm(TOP, 8);
+			as.load(RSI, TOP, -8);
+			as.store(RCX, objectSlots, RSI);
+			callHelper((void *)writeBarrier);
+			jumpTo(ip + 5);
+			return true;
+
+		case Bytecode::CODE_construct: {
+			// only the outermost constructor creates the receiver
+			as.cmpMemImm(true, STACK, 0, ValueNil.val.value);
+			size_t created = as.jcc(CC_NE);
+			as.mov(RDI, STACK);
+			as.load(RSI, LOCALS, operand(ip + 1) * 8);
+			callHelper((void *)construct);
+			as.bind(created);
+			return true;
+		}
+		case Bytecode::CODE_load_module:
+		case Bytecode::CODE_load_module_super:
+			as.mov(RDI, STACK);
+			as.movImm(RSI, op == Bytecode::CODE_load_module_super);
+			callHelper((void *)loadModule);
+			push(RAX);
+			return true;
+
+		case Bytecode::CODE_neg: {
+			as.load(RAX, TOP, -8);
+			size_t notInt = notInteger(RAX);
+			as.mov(RDX, RAX);
+			as.sar(RDX, 4);
+			// -0 is a double
+			as.test(RDX, RDX);
+			size_t zero = as.jcc(CC_E);
+			as.neg(RDX);
+			size_t big = notSmall(RDX);
+			tagInteger(RDX);
+			as.store(TOP, -8, RDX);
+			size_t done = as.jmp();
+			as.bind(notInt), as.bind(zero), as.bind(big);
+			toDouble(0, RAX, tos(1), ip);
+			as.movqFromXmm(RAX, 0);
+			as.btcSign(RAX);
+			as.orImm(RAX, 1);
+			as.store(TOP, -8, RAX);
+			as.bind(done);
+			return true;
+		}
+		case Bytecode::CODE_lnot: {
+			as.load(RAX, TOP, -8);
+			as.movImm(RCX, ValueFalse.val.value);
+			size_t isFalsey[4];
+			for(int i = 0; i < 4; i++) {
+				as.cmpImm(RAX, falsey[i]);
+				isFalsey[i] = as.jcc(CC_E);
+			}
+			size_t done = as.jmp();
+			for(size_t j : isFalsey) as.bind(j);
+			as.movImm(RCX, ValueTrue.val.value);
+			as.bind(done);
+			as.store(TOP, -8, RCX);
+			return true;
+		}
+
+		case Bytecode::CODE_add:
+		case Bytecode::CODE_add_num_num:
+			arithmetic(Assembler::ADDSD, tos(2), tos(1), ip);
+			return true;
+		case Bytecode::CODE_add_int_int:
+			arithmetic(Assembler::ADDSD, tos(2), tos(1), ip, true);
+			return true;
+		case Bytecode::CODE_sub:
+		case Bytecode::CODE_sub_num_num:
+			arithmetic(Assembler::SUBSD, tos(2), tos(1), ip);
+			return true;
+		case Bytecode::CODE_sub_int_int:
+			arithmetic(Assembler::SUBSD, tos(2), tos(1), ip, true);
+			return true;
+		case Bytecode::CODE_mul:
+		case Bytecode::CODE_mul_num_num:
+			arithmetic(Assembler::MULSD, tos(2), tos(1), ip);
+			return true;
+		case Bytecode::CODE_mul_int_int:
+			arithmetic(Assembler::MULSD, tos(2), tos(1), ip, true);
+			return true;
+		case Bytecode::CODE_div:
+		case Bytecode::CODE_div_num_num:
+			arithmetic(Assembler::DIVSD, tos(2), tos(1), ip);
+			return true;
+		case Bytecode::CODE_div_int_int:
+			arithmetic(Assembler::DIVSD, tos(2), tos(1), ip, true);
+			return true;
+		case Bytecode::CODE_incr:
+			arithmetic(Assembler::ADDSD, tos(1), one(), ip);
+			return true;
+		case Bytecode::CODE_decr:
+			arithmetic(Assembler::SUBSD, tos(1), one(), ip);
+			return true;
+
+#define ARITHMETIC(x, sse)                                                   \
+	case Bytecode::CODE_##x##_ss:                                            \
+	/* the store_slot_pop following _sss is compiled on its own */           \
+	case Bytecode::CODE_##x##_sss:                                           \
+		arithmetic(sse, slot(ip + 1), slot(ip + 2), ip);                     \
+		return true;                                                         \
+	case Bytecode::CODE_##x##_ts:                                            \
+		arithmetic(sse, tos(1), slot(ip + 1), ip);                           \
+		return true;                                                         \
+	case Bytecode::CODE_##x##_tc:                                            \
+		arithmetic(sse, tos(1), constant(ip + 1), ip);                       \
+		return true;                                                         \
+	case Bytecode::CODE_##x##_sc:                                            \
+		arithmetic(sse, slot(ip + 1), constant(ip + 2), ip);                 \
+		return true;
+		ARITHMETIC(add, Assembler::ADDSD)
+		ARITHMETIC(sub, Assembler::SUBSD)
+		ARITHMETIC(mul, Assembler::MULSD)
+		ARITHMETIC(div, Assembler::DIVSD)
+#undef ARITHMETIC
+
+#define REGISTER_OPCODE(x)
+#define COMPARE_OPCODE(x)                                                    \
+	case Bytecode::CODE_##x:                                                 \
+	case Bytecode::CODE_##x##_int_int:                                       \
+	case Bytecode::CODE_##x##_num_num:                                       \
+		compare(Bytecode::CODE_##x, tos(2), tos(1), ip);                     \
+		return true;                                                         \
+	case Bytecode::CODE_##x##_ss:                                            \
+	case Bytecode::CODE_##x##_sss:                                           \
+		compare(Bytecode::CODE_##x, slot(ip + 1), slot(ip + 2), ip);         \
+		return true;                                                         \
+	case Bytecode::CODE_##x##_ts:                                            \
+		compare(Bytecode::CODE_##x, tos(1), slot(ip + 1), ip);               \
+		return true;                                                         \
+	case Bytecode::CODE_##x##_tc:                                            \
+		compare(Bytecode::CODE_##x, tos(1), constant(ip + 1), ip);           \
+		return true;                                                         \
+	case Bytecode::CODE_##x##_sc:                                            \
+		compare(Bytecode::CODE_##x, slot(ip + 1), constant(ip + 2), ip);     \
+		return true;                                                         \
+	case Bytecode::CODE_##x##_jumpiffalse:                                   \
+		return compareJump(Bytecode::CODE_##x, tos(2), tos(1), ip);          \
+	case Bytecode::CODE_##x##_ss_jumpiffalse:                                \
+		return compareJump(Bytecode::CODE_##x, slot(ip + 1), slot(ip + 2),   \
+		                   ip);                                              \
+	case Bytecode::CODE_##x##_ts_jumpiffalse:                                \
+		return compareJump(Bytecode::CODE_##x, tos(1), slot(ip + 1), ip);    \
+	case Bytecode::CODE_##x##_tc_jumpiffalse:                                \
+		return compareJump(Bytecode::CODE_##x, tos(1), constant(ip + 1),     \
+		                   ip);                                              \
+	case Bytecode::CODE_##x##_sc_jumpiffalse:                                \
+		return compareJump(Bytecode::CODE_##x, slot(ip + 1),                 \
+		                   constant(ip + 2), ip);
+#include "register_opcodes.h"
+
+		case Bytecode::CODE_bcall_fast_eq:
+		case Bytecode::CODE_bcall_fast_neq: {
+			// compare the class of the left operand with the
+			// cached one
+			as.load(RAX, TOP, -16);
+			classOf(RAX);
+			as.cmpMem(RDX, LOCALS, operand(ip + 1) * 8);
+			size_t cached = as.jcc(CC_E);
+			// only objects can overload the operator
+			as.testLow(RAX, 3);
+			exitTo(CC_E, ip);
+			as.bind(cached);
+			as.load(RCX, TOP, -8);
+			as.cmp(RAX, RCX);
+			size_t same = as.jcc(CC_E);
+			// a small integer and a double may still be equal,
+			// let the interpreter compare them. the last bits
+			// differ only if one of them is a double.
+			as.mov(RDX, RAX);
+			as.add(RDX, RCX);
+			as.testLow(RDX, 1);
+			size_t different = as.jcc(CC_E);
+			as.testLow(RAX, 1);
+			size_t leftDouble = as.jcc(CC_NE);
+			size_t notMixed   = notInteger(RAX);
+			fixup(as.jmp(), ip, true);
+			as.bind(leftDouble);
+			size_t rightNotInteger = notInteger(RCX);
+			fixup(as.jmp(), ip, true);
+			as.bind(different), as.bind(notMixed), as.bind(rightNotInteger);
+			as.cmp(RAX, RCX);
+			as.bind(same);
+			as.setcc(op == Bytecode::CODE_bcall_fast_eq ? CC_E : CC_NE);
+			as.boolean();
+			as.store(TOP, -16, RAX);
+			as.subImm(TOP, 8);
+			// skip the eq/neq
+			jumpTo(ip + 3);
+			return true;
+		}
+
+		case Bytecode::CODE_call_fast_method:
+		case Bytecode::CODE_call_fast_method_soft: {
+			int  idx  = operand(ip + 1);
+			int  args = operand(ip + 2);
+			bool soft = op == Bytecode::CODE_call_fast_method_soft;
+			as.load(RAX, TOP, -(args + 1) * 8);
+			if(soft) {
+				// the receiver is the cached class itself
+				as.cmpMem(RAX, LOCALS, idx * 8);
+				exitTo(CC_NE, ip);
+			} else {
+				// check the cached class of the receiver
+				checkObjectClass(RAX, idx, ip);
+			}
+			as.mov(RDI, FIBER);
+			as.mov(RSI, TOP);
+			as.load(RDX, LOCALS, (idx + 1) * 8);
+			as.movImm(RCX, args);
+			// the ip is backed up at the end of the call that
+			// follows, like the engine does
+			as.movImm(R8, (uintptr_t)(b->bytecodes + ip + 5));
+			as.movImm(R9, soft);
+			callHelper((void *)callMethod);
+			switchTo(ip, idx);
+			return true;
+		}
+		case Bytecode::CODE_call_fast_builtin: {
+			int idx  = operand(ip + 1);
+			int args = operand(ip + 2);
+			as.load(RAX, TOP, -(args + 1) * 8);
+			classOf(RAX);
+			as.cmpMem(RDX, LOCALS, idx * 8);
+			exitTo(CC_NE, ip);
+			as.mov(RDI, FIBER);
+			as.mov(RSI, TOP);
+			as.load(RDX, LOCALS, (idx + 1) * 8);
+			as.movImm(RCX, args);
+			as.movImm(R8, (uintptr_t)(b->bytecodes + ip + 5));
+			callHelper((void *)callBuiltin);
+			as.test(RAX, RAX);
+			exitTo(CC_E, ip);
+			countHit(idx);
+			as.cmpImm(RAX, RETURNED);
+			size_t exited = as.jcc(CC_NE);
+			// the builtin may have grown the stack
+			as.load(TOP, FIBER, fiberStackTop);
+			as.load(RCX, FIBER, fiberFrame);
+			as.load(STACK, RCX, frameStack);
+			// skip the call that follows
+			jumpTo(ip + 6);
+			as.bind(exited);
+			as.cmpImm(RAX, NOT_COMPILED);
+			as.link(as.jcc(CC_E), switched);
+			as.link(as.jmp(), thrown);
+			return true;
+		}
+		case Bytecode::CODE_call_fast_poly:
+		case Bytecode::CODE_call_fast_mega: {
+			int idx  = operand(ip + 1);
+			int args = operand(ip + 2);
+			as.load(RAX, TOP, -(args + 1) * 8);
+			if(op == Bytecode::CODE_call_fast_poly) {
+				// loads the function of the matching class to rdx
+				classOf(RAX);
+				size_t found[Bytecode::CallCacheSize];
+				for(int i = 0; i < Bytecode::CallCacheSize; i++) {
+					as.cmpMem(RDX, LOCALS, (idx + 2 * i) * 8);
+					size_t next = as.jcc(CC_NE);
+					as.load(RDX, LOCALS, (idx + 2 * i + 1) * 8);
+					found[i] = as.jmp();
+					as.bind(next);
+				}
+				fixup(as.jmp(), ip, true);
+				for(size_t f : found) as.bind(f);
+			} else {
+				as.mov(RDI, RAX);
+				as.movImm(RSI, operand(ip + 4));
+				callHelper((void *)lookupMethod);
+				as.test(RAX, RAX);
+				exitTo(CC_E, ip);
+				as.mov(RDX, RAX);
+			}
+			as.mov(RDI, FIBER);
+			as.mov(RSI, TOP);
+			as.movImm(RCX, args);
+			as.movImm(R8, (uintptr_t)(b->bytecodes + ip + 5));
+			callHelper((void *)callFunction);
+			as.test(RAX, RAX);
+			exitTo(CC_E, ip);
+			countHit(idx);
+			as.cmpImm(RAX, RETURNED);
+			size_t entered = as.jcc(CC_NE);
+			// a builtin has returned, and may have grown the stack
+			as.load(TOP, FIBER, fiberStackTop);
+			as.load(RCX, FIBER, fiberFrame);
+			as.load(STACK, RCX, frameStack);
+			jumpTo(ip + 6);
+			as.bind(entered);
+			as.cmpImm(RAX, THREW);
+			as.link(as.jcc(CC_E), thrown);
+			// a method, or a builtin which has switched the fiber
+			enterFrame();
+			return true;
+		}
+		case Bytecode::CODE_ret:
+			as.mov(RDI, FIBER);
+			as.mov(RSI, TOP);
+			callHelper((void *)returnFrom);
+			switchTo(ip);
+			return true;
+
+		default: return false;
+	}
+}
+
+Jit::Code *Compiler::compile() {
+	prologue();
+	size_t ip = 0;
+	while(ip < b->size) {
+		size_t fixupsBefore = numFixups;
+		native[ip]          = as.size;
+		compiled[ip]        = emit(ip);
+		if(!compiled[ip]) {
+			// discard the template, if it has emitted any
+			as.size   = native[ip];
+			numFixups = fixupsBefore;
+			exitNow(ip);
+		}
+		ip += opcodeLengths[b->bytecodes[ip]];
+	}
+	native[b->size] = as.size;
+	exitNow(b->size);
+	// link the jumps between the instructions
+	for(size_t i = 0; i < numFixups; i++) {
+		Fixup &f = fixups[i];
+		if(!f.exit)
+			as.link(f.at, native[f.target]);
+	}
+	// emit the exits of the guards. the guards of an instruction
+	// are emitted one after another, so they share a single exit.
+	size_t lastExit = (size_t)-1, lastStub = 0;
+	for(size_t i = 0; i < numFixups; i++) {
+		Fixup &f = fixups[i];
+		if(!f.exit)
+			continue;
+		if(f.target != lastExit) {
+			lastExit = f.target;
+			lastStub = as.size;
+			exitNow(f.target);
+		}
+		as.link(f.at, lastStub);
+	}
+
+	size_t   pageSize = sysconf(_SC_PAGESIZE);
+	size_t   mapped   = (as.size + pageSize - 1) & ~(pageSize - 1);
+	uint8_t *memory   = (uint8_t *)mmap(NULL, mapped, PROT_READ | PROT_WRITE,
+                                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(memory == MAP_FAILED)
+		return nullptr;
+	memcpy(memory, as.buf, as.size);
+	if(mprotect(memory, mapped, PROT_READ | PROT_EXEC) != 0) {
+		munmap(memory, mapped);
+		return nullptr;
+	}
+
+	Jit::Code *code    = (Jit::Code *)Gc_malloc(sizeof(Jit::Code));
+	code->memory       = memory;
+	code->mappedSize   = mapped;
+	code->numEntries   = b->size;
+	code->compiledFrom = (int32_t *)Gc_malloc(sizeof(int32_t) * b->size);
+	memcpy(code->compiledFrom, b->bytecodes, sizeof(int32_t) * b->size);
+	code->recompiles = 0;
+	code->previous   = nullptr;
+	code->entries    = (void **)Gc_malloc(sizeof(void *) * b->size);
+	for(size_t i = 0; i < b->size; i++) code->entries[i] = nullptr;
+	for(ip = 0; ip < b->size; ip += opcodeLengths[b->bytecodes[ip]])
+		if(compiled[ip])
+			code->entries[ip] = memory + native[ip];
+	return code;
+}
+
+// number of times a bytecode is compiled again after
+// its instructions are patched
+const int maxRecompiles = 8;
+
+// compiles the bytecode again if the instruction at ip has
+// been patched since it was compiled
+void recompileIfPatched(Bytecode *b, size_t ip) {
+	Jit::Code *code = b->jit;
+	if(code == nullptr)
+		return;
+	// patching never changes the length of an instruction
+	size_t length = sizeof(int32_t) * opcodeLengths[b->bytecodes[ip]];
+	if(code->recompiles == maxRecompiles ||
+	   memcmp(b->bytecodes + ip, code->compiledFrom + ip, length) == 0)
+		return;
+	Compiler   c(b);
+	Jit::Code *recompiled = c.compile();
+	if(recompiled == nullptr)
+		return;
+	recompiled->recompiles = code->recompiles + 1;
+	recompiled->previous   = code;
+	b->jit                 = recompiled;
+}
+
+} // namespace
+
+bool Jit::count(Bytecode *b) {
+	// only tries to compile once
+	if(++b->jitCounter != threshold + 1)
+		return false;
+	Compiler c(b);
+	b->jit = c.compile();
+	return b->jit != nullptr;
+}
+
+int64_t Jit::enter(Fiber *f, void *entry) {
+	typedef int64_t (*Trampoline)(Value *, Fiber *, Value *, void *);
+	Fiber::CallFrame *frame      = f->getCurrentFrame();
+	Trampoline        trampoline = (Trampoline)frame->f->code->jit->memory;
+	int64_t           offset =
+	    trampoline(frame->stack_, f, frame->locals, entry);
+	if(offset >= 0)
+		recompileIfPatched(f->getCurrentFrame()->f->code, offset);
+	return offset;
+}
+
+void Jit::release(Bytecode *b) {
+	b->jitCounter = 0;
+	while(b->jit != nullptr) {
+		Code *code = b->jit;
+		munmap(code->memory, code->mappedSize);
+		Gc_free(code->entries, sizeof(void *) * code->numEntries);
+		Gc_free(code->compiledFrom, sizeof(int32_t) * code->numEntries);
+		b->jit = code->previous;
+		Gc_free(code, sizeof(Code));
+	}
+}
+#endif
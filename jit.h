@@ -0,0 +1,83 @@
+#pragma once
+
+// baseline jit
+// ------------
+// once a bytecode is entered or loops back more than
+// 'threshold' times, it is translated to x86-64 machine code
+// by stitching a template for each opcode. the templates
+// inline the fast paths of the number arithmetic, the
+// comparisons, the jumps, the slot accesses, the eq/neq
+// caches, and the cached calls and ret between compiled
+// functions. everything else, and every failed guard, exits
+// to the interpreter at the start of the instruction, which
+// interprets it, and enters the compiled code again right
+// after it.
+//
+// it needs NEXT_USE_COMPUTED_GOTO, since the engine enters
+// the compiled code again by switching its dispatch table.
+#if defined(NEXT_USE_JIT) &&                                  \
+    (!defined(__x86_64__) || !defined(NEXT_USE_COMPUTED_GOTO) || \
+     defined(NEXT_PROFILE_OPCODES) || defined(_WIN32))
+#undef NEXT_USE_JIT
+#endif
+
+#ifdef NEXT_USE_JIT
+#include <cstddef>
+#include <cstdint>
+
+struct Bytecode;
+struct Fiber;
+struct Value;
+
+struct Jit {
+	// compiled code of a bytecode
+	struct Code {
+		// mapped executable memory, which starts with the
+		// entry trampoline
+		uint8_t *memory;
+		size_t   mappedSize;
+		// native address of each instruction, indexed by its
+		// offset in the bytecode. it is null for the operands,
+		// and for the instructions which always exit.
+		void **entries;
+		size_t numEntries;
+		// the instructions it was compiled from. the engine
+		// patches some of them in place, and the bytecode is
+		// compiled again when the code exits at one of those.
+		int32_t *compiledFrom;
+		int      recompiles;
+		// the code it has replaced, which may still be running
+		// deeper in the native stack
+		Code *previous;
+	};
+
+	// number of times a bytecode has to be entered before it
+	// is compiled, read from NEXT_JIT_THRESHOLD. 0 compiles
+	// every bytecode when it is first entered.
+	static size_t threshold;
+	static void   init();
+
+	// counts an entry to the bytecode, and compiles it when
+	// it becomes hot. returns true if it has been compiled.
+	static inline bool hot(Bytecode *b);
+	static bool        count(Bytecode *b);
+
+	// returns the native address of the instruction at ip,
+	// or null if it is not compiled
+	static inline void *entry(Bytecode *b, const void *ip);
+
+	// runs the compiled code from 'entry', which belongs to
+	// the current frame of the fiber. returns the offset
+	// of the instruction to interpret next in the bytecode
+	// of the then current frame, or one of these. the frame
+	// and the fiber may have been switched by then.
+	enum {
+		SWITCHED = -1, // ip of the frame points to the next instruction
+		THROWN   = -2, // a builtin has thrown an exception
+	};
+	static int64_t enter(Fiber *f, void *entry);
+
+	// releases the compiled code of the bytecode
+	static void release(Bytecode *b);
+};
+#endif
@@ -1,7 +1,9 @@
 #include "loader.h"
 #include "engine.h"
+#include "modulecache.h"
 #include "objects/fiber.h"
 #include "objects/functioncompilationctx.h"
+#include "objects/symtab.h"
 #include "parser.h"
 #include "printer.h"
 #include <stdexcept>
@@ -163,30 +165,41 @@ GcObject *Loader::compile_and_load_with_name(const void *fileName,
 		return ExecutionEngine::getRegisteredModule(fname);
 	Scanner s(fileName);
 	try {
-		::new(&parser) Parser(s);
-		::new(&generator) CodeGenerator();
-		isCompiling = true;
-		registerParselets(&parser);
-		Array2 decls = parser.parseAllDeclarations();
-		parser.releaseAll();
+		Class2 module =
+		    ModuleCache::load(fname, modName, s.getSource(), s.getFileName());
+		if(module == NULL) {
+			::new(&parser) Parser(s);
+			::new(&generator) CodeGenerator();
+			isCompiling = true;
+			registerParselets(&parser);
+			Array2 decls = parser.parseAllDeclarations();
+			parser.releaseAll();
 #ifdef DEBUG
-		for(int i = 0; i < decls->size; i++) {
-			sp.print(decls->values[i].toStatement());
-			Printer::print("\n");
-		}
-		Printer::println("Parsed successfully!");
+			for(int i = 0; i < decls->size; i++) {
+				sp.print(decls->values[i].toStatement());
+				Printer::print("\n");
+			}
+			Printer::println("Parsed successfully!");
 #endif
-		ClassCompilationContext2 ctx =
-		    ClassCompilationContext::create(NULL, modName);
-		generator.compile(ctx, decls);
-		isCompiling = false;
+			ClassCompilationContext2 ctx =
+			    ClassCompilationContext::create(NULL, modName);
+			generator.compile(ctx, decls);
+			isCompiling = false;
+			// the module is cached before it is executed, since
+			// the engine patches the bytecode while running it
+			ModuleCache::store(fname, ctx, s.getSource());
+			module = ctx->get_class();
+		}
 		if(execute) {
 			Value v;
 			if(ExecutionEngine::registerModule(
-			       fname, ctx->get_default_constructor()->f, &v))
+			       fname,
+			       module->get_fn(SymbolTable2::const_sig_constructor_0)
+			           .toFunction(),
+			       &v))
 				ret = v.toGcObject();
 		} else {
-			ret = (GcObject *)ctx->get_class();
+			ret = (GcObject *)(Class *)module;
 		}
 	} catch(ParseException &pe) {
 		if(pe.getToken().source.source != NULL) {
@@ -1,4 +1,10 @@
 #include "memman.h"
 
 MemoryManager::Arena *MemoryManager::arenaList                      = nullptr;
+std::mutex            MemoryManager::arenaLock;
 size_t MemoryManager::poolNumAvailBlocks[MemoryManager::blockCount] = {0};
+size_t              MemoryManager::pageSize = 4096;
+MemoryManager::Span MemoryManager::largeCache[MemoryManager::largeCacheSpans];
+size_t              MemoryManager::largeCacheCount    = 0;
+size_t              MemoryManager::largeCacheResident = 0;
+std::mutex          MemoryManager::largeLock;
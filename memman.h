@@ -4,10 +4,16 @@
 #include <cstdint>
 #include <cstdlib>
 #include <cstring>
+#include <mutex>
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
 struct MemoryManager {
 
 	struct Block;
+	struct Arena;
 
 	using size_t = std::size_t;
 
@@ -29,7 +35,7 @@ struct MemoryManager {
 
 	static const size_t arenaSize     = 1024 * 1024; // 1 MiB
 	static const size_t poolsPerArena = 64;
-	static const size_t poolSize      = arenaSize / poolsPerArena; // 128 KiB
+	static const size_t poolSize      = arenaSize / poolsPerArena; // 16 KiB
 	static size_t       poolNumAvailBlocks[blockCount];
 
 	struct Block {
@@ -40,10 +46,10 @@ struct MemoryManager {
 		void *nextBlock;
 	};
 
+	// pools are aligned to poolSize, and each of them starts
+	// with its own header, so the pool of a block is found by
+	// masking off the lower bits of its address.
 	struct Pool {
-		// start and end of this pools memory
-		void *startMem;
-		void *endMem;
 		// number of available blocks in this pool
 		size_t numAvailBlocks;
 		// pointer to the next free block in this pool
@@ -52,10 +58,16 @@ struct MemoryManager {
 		char *lastBlock;
 		// size of the blocks in this pool
 		size_t blockSize;
-		// pointer to the next pool in
-		// the same arena of the same
-		// size class
+		// pointer to the next and previous
+		// pool in the same arena of the
+		// same size class
 		struct Pool *nextPool;
+		struct Pool *prevPool;
+		// the arena this pool is carved from
+		Arena *arena;
+		// set when the pool is free, and its pages
+		// are given back to the OS by trim()
+		bool trimmed;
 		// will return NULL if the pool
 		// does not have any more block
 		// to allocate
@@ -80,32 +92,30 @@ struct MemoryManager {
 			numAvailBlocks++;
 		}
 
-		static Pool *create(size_t blockSize, void *mem, size_t cls) {
-			Pool *p = (Pool *)std::malloc(sizeof(Pool));
-			if(p == nullptr) {
-				Printer::Err("Unable to allocate a pool!");
-				exit(1);
-			}
-			// initialize the memory boundary one time
-			p->startMem = mem;
-			p->endMem   = (char *)mem + poolSize - 1;
-			p->init(blockSize, cls);
-			return p;
-		}
-
 		void init(size_t blockSiz, size_t cls) {
-			lastBlock      = ((char *)startMem - blockSiz);
+			// the blocks start right after the header
+			lastBlock      = ((char *)this + poolHeaderSize - blockSiz);
 			blockSize      = blockSiz;
 			numAvailBlocks = poolNumAvailBlocks[cls];
 			nextPool       = nullptr;
+			prevPool       = nullptr;
 			nextBlock      = nullptr;
+			trimmed        = false;
 		}
 	};
+	static const size_t poolHeaderSize =
+	    (sizeof(Pool) + blockWidth - 1) & -blockWidth;
+
+	// returns the pool which holds the block
+	static Pool *poolOf(void *mem) {
+		return (Pool *)((uintptr_t)mem & ~(uintptr_t)(poolSize - 1));
+	}
 
 	struct Arena {
-		// the beginning and end of the total mallocated memory
+		// the memory returned by malloc, and the
+		// first poolSize aligned address in it
+		void *rawMemory;
 		void *beginMemory;
-		void *endMemory;
 		// last allocated pool block
 		char *lastPoolBlock;
 		// number of available pools
@@ -130,13 +140,15 @@ struct MemoryManager {
 			for(size_t i = 0; i < blockCount; i++) {
 				a->pools[i] = nullptr;
 			}
-			// allocate the memory
-			a->beginMemory = std::malloc(arenaSize);
-			if(a->beginMemory == nullptr) {
+			// allocate the memory, with enough room
+			// to align the pools
+			a->rawMemory = std::malloc(arenaSize + poolSize);
+			if(a->rawMemory == nullptr) {
 				Printer::Err("Unable to allocate memory for arena!");
 				exit(1);
 			}
-			a->endMemory     = (char *)a->beginMemory + arenaSize - 1;
+			a->beginMemory = (void *)(((uintptr_t)a->rawMemory + poolSize - 1) &
+			                          ~(uintptr_t)(poolSize - 1));
 			a->lastPoolBlock = ((char *)a->beginMemory - poolSize);
 			a->nextArena     = nullptr;
 			a->freePools     = nullptr;
@@ -158,12 +170,13 @@ struct MemoryManager {
 					// arena, we certainly need to
 					// carve a new block for this pool
 					lastPoolBlock += poolSize;
-					p = Pool::create(size, lastPoolBlock, cls);
+					p        = (Pool *)lastPoolBlock;
+					p->arena = this;
+					p->init(size, cls);
 				}
 				// put this pool in the beginning of
 				// the queue of its size class
-				p->nextPool = pools[cls];
-				pools[cls]  = p;
+				pushPool(p, cls);
 				availPools--;
 				return p;
 			}
@@ -182,14 +195,12 @@ struct MemoryManager {
 				// for the size class. if we have one that can allocate
 				// this block, we're good
 				while(p->nextPool) {
-					Pool *parent = p;
-					p            = p->nextPool;
-					m            = p->allocateBlock();
+					p = p->nextPool;
+					m = p->allocateBlock();
 					if(m) {
 						// put that pool to the front of the queue
-						parent->nextPool = p->nextPool;
-						p->nextPool      = pools[cls];
-						pools[cls]       = p;
+						unlinkPool(p, cls);
+						pushPool(p, cls);
 						return m;
 					}
 				}
@@ -203,53 +214,44 @@ struct MemoryManager {
 			return nullptr;
 		}
 
-		void releaseBlock(void *mem, size_t cls) {
-			Pool * p         = pools[cls];
-			size_t numBlocks = poolNumAvailBlocks[cls];
-			// check if it is in the front of the pool list
-			if(mem >= p->startMem && mem <= p->endMem) {
-				p->releaseBlock(mem);
-				// check if the pool is all free
-				if(p->numAvailBlocks == numBlocks) {
-					releasePool(p, nullptr, cls);
-				}
-				return;
-			}
-			Pool *poolParent = p;
-			p                = p->nextPool;
-			while(p) {
-				// find the block
-				if(mem >= p->startMem && mem <= p->endMem) {
-					p->releaseBlock(mem);
-					// check if the pool is all free
-					if(p->numAvailBlocks == numBlocks) {
-						releasePool(p, poolParent, cls);
-					} else {
-						// release can only happen in case of a gc,
-						// and so, we're assuming that subsequent
-						// releases are going to refer this same pool.
-						// so we're putting this pool in the front
-						// of the queue, which we know it isn't already
-						poolParent->nextPool = p->nextPool;
-						p->nextPool          = pools[cls];
-						pools[cls]           = p;
-					}
-					break;
-				}
-				poolParent = p;
-				p          = p->nextPool;
+		void releaseBlock(Pool *p, void *mem, size_t cls) {
+			p->releaseBlock(mem);
+			// check if the pool is all free
+			if(p->numAvailBlocks == poolNumAvailBlocks[cls]) {
+				releasePool(p, cls);
+			} else if(p != pools[cls]) {
+				// release can only happen in case of a gc,
+				// and so, we're assuming that subsequent
+				// releases are going to refer this same pool.
+				// so we're putting this pool in the front
+				// of the queue
+				unlinkPool(p, cls);
+				pushPool(p, cls);
 			}
 		}
 
-		void releasePool(Pool *p, Pool *parent, size_t cls) {
+		void pushPool(Pool *p, size_t cls) {
+			p->prevPool = nullptr;
+			p->nextPool = pools[cls];
+			if(pools[cls])
+				pools[cls]->prevPool = p;
+			pools[cls] = p;
+		}
+
+		void unlinkPool(Pool *p, size_t cls) {
+			if(p->prevPool)
+				p->prevPool->nextPool = p->nextPool;
+			else
+				pools[cls] = p->nextPool;
+			if(p->nextPool)
+				p->nextPool->prevPool = p->prevPool;
+		}
+
+		void releasePool(Pool *p, size_t cls) {
 			// we don't need to release the block it is
 			// holding, we can just add it to the free list
 			// and call it a day
-			if(parent) {
-				parent->nextPool = p->nextPool;
-			} else {
-				pools[cls] = p->nextPool;
-			}
+			unlinkPool(p, cls);
 			// add it to the freePool list
 			p->nextPool = freePools;
 			freePools   = p;
@@ -257,57 +259,211 @@ struct MemoryManager {
 		}
 
 		void releaseAll() {
-			// release all the pools
-			for(size_t i = 0; i < blockCount; i++) {
-				Pool *bak = pools[i];
-				while(bak) {
-					Pool *rel = bak;
-					bak       = bak->nextPool;
-					std::free(rel);
+			// the pools live in the memory itself,
+			// so just release the memory
+			std::free(rawMemory);
+		}
+	};
+
+	static Arena *arenaList;
+	// guards the arenas, which are shared by all the threads
+	static std::mutex arenaLock;
+
+	// allocates a block of 'size' bytes, which must be a
+	// multiple of blockWidth, from the arenas
+	static void *allocateBlock(size_t size) {
+		// try allocating from the top arena
+		void *m = arenaList->allocateBlock(size);
+		if(m)
+			return m;
+		// try allocating from the next arenas
+		Arena *current = arenaList;
+		while(current->nextArena) {
+			Arena *parent = current;
+			current       = current->nextArena;
+			m             = current->allocateBlock(size);
+			if(m) {
+				// put this arena to the front
+				parent->nextArena  = current->nextArena;
+				current->nextArena = arenaList;
+				arenaList          = current;
+				return m;
+			}
+		}
+		// we reached the end, so we need a new arena
+		Arena *a     = Arena::create();
+		a->nextArena = arenaList;
+		arenaList    = a;
+		return a->allocateBlock(size); // we're sure we can do this
+	}
+
+	// each thread keeps a magazine of free blocks for each size
+	// class, so that most allocations and releases do not touch
+	// the arenas at all. an empty magazine is refilled with
+	// magazineSize blocks at once, and a full one gives back
+	// magazineSize blocks at once, so that the arenas are only
+	// locked once for a batch.
+	static const size_t magazineSize = 32;
+	struct Magazine {
+		size_t count;
+		void * blocks[magazineSize * 2];
+	};
+	struct ThreadCache {
+		Magazine magazines[blockCount];
+		ThreadCache() {
+			for(size_t i = 0; i < blockCount; i++) magazines[i].count = 0;
+		}
+		// give everything back when the thread exits
+		~ThreadCache() { flush(); }
+
+		void refill(Magazine &m, size_t size) {
+			std::lock_guard<std::mutex> l(arenaLock);
+			while(m.count < magazineSize)
+				m.blocks[m.count++] = allocateBlock(size);
+		}
+
+		void release(Magazine &m, size_t size, size_t count) {
+			std::lock_guard<std::mutex> l(arenaLock);
+			while(count-- > 0) releaseBlock(m.blocks[--m.count], size);
+		}
+
+		void flush() {
+			for(size_t i = 0; i < blockCount; i++)
+				release(magazines[i], blockWidth * (i + 1),
+				        magazines[i].count);
+		}
+	};
+	static ThreadCache &threadCache() {
+		static thread_local ThreadCache cache;
+		return cache;
+	}
+
+	// large object space
+	// ------------------
+	// allocations of at least largeObjectSize bytes are mapped
+	// directly from the OS in whole pages, so that they do not
+	// fragment the heap of malloc. released spans are kept for
+	// reuse, at most largeCacheSpans of them. up to
+	// largeResidentSize bytes of them are kept as they are,
+	// since faulting in fresh pages is what makes the mapped
+	// memory slow, and the pages of the rest are handed back to
+	// the OS with MADV_DONTNEED. the spans between blockEnd and
+	// largeObjectSize are still allocated by malloc, since
+	// rounding them up to whole pages would waste too much memory.
+	static const size_t largeObjectSize   = 32 * 1024;
+	static const size_t largeResidentSize = 16 * 1024 * 1024;
+	static const size_t largeCacheSpans   = 256;
+	struct Span {
+		void * mem;
+		size_t pages;
+		bool   resident;
+	};
+	static size_t     pageSize;
+	static Span       largeCache[largeCacheSpans];
+	static size_t     largeCacheCount;
+	static size_t     largeCacheResident;
+	static std::mutex largeLock;
+
+	static size_t pagesFor(size_t size) {
+		return (size + pageSize - 1) / pageSize;
+	}
+
+	static void *allocateLarge(size_t size, bool zero) {
+#ifdef _WIN32
+		return zero ? std::calloc(1, size) : std::malloc(size);
+#else
+		size_t pages = pagesFor(size);
+		{
+			std::lock_guard<std::mutex> l(largeLock);
+			// try to reuse a span of the same size
+			for(size_t i = 0; i < largeCacheCount; i++) {
+				if(largeCache[i].pages == pages) {
+					Span s        = largeCache[i];
+					largeCache[i] = largeCache[--largeCacheCount];
+					if(s.resident)
+						largeCacheResident -= pages * pageSize;
+					// the pages are not guaranteed to be
+					// zeroed after MADV_DONTNEED everywhere
+					if(zero)
+						std::memset(s.mem, 0, pages * pageSize);
+					return s.mem;
 				}
 			}
-			while(freePools) {
-				Pool *rel = freePools;
-				freePools = freePools->nextPool;
-				std::free(rel);
+		}
+		void *m = mmap(NULL, pages * pageSize, PROT_READ | PROT_WRITE,
+		               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if(m == MAP_FAILED)
+			return NULL;
+		return m;
+#endif
+	}
+
+	static void releaseLarge(void *mem, size_t size) {
+#ifdef _WIN32
+		(void)size;
+		std::free(mem);
+#else
+		size_t pages = pagesFor(size), bytes = pages * pageSize;
+		{
+			std::lock_guard<std::mutex> l(largeLock);
+			if(largeCacheCount < largeCacheSpans) {
+				bool resident = largeCacheResident + bytes <= largeResidentSize;
+				if(resident)
+					largeCacheResident += bytes;
+				else
+					// keep the address range, but give
+					// the memory back
+					madvise(mem, bytes, MADV_DONTNEED);
+				largeCache[largeCacheCount++] = {mem, pages, resident};
+				return;
 			}
-			// release the memory
-			std::free(beginMemory);
 		}
-	};
+		munmap(mem, bytes);
+#endif
+	}
 
-	static Arena *arenaList;
+	static void *reallocateLarge(void *mem, size_t oldb, size_t newb) {
+#ifdef _WIN32
+		(void)oldb;
+		return std::realloc(mem, newb);
+#else
+		size_t oldPages = pagesFor(oldb), newPages = pagesFor(newb);
+		// it still fits in the same pages
+		if(oldPages == newPages)
+			return mem;
+		// return the extra pages
+		if(newPages < oldPages) {
+			munmap((char *)mem + newPages * pageSize,
+			       (oldPages - newPages) * pageSize);
+			return mem;
+		}
+#ifdef __linux__
+		void *m = mremap(mem, oldPages * pageSize, newPages * pageSize,
+		                 MREMAP_MAYMOVE);
+		return m == MAP_FAILED ? NULL : m;
+#else
+		void *m = allocateLarge(newb, false);
+		if(m == NULL)
+			return NULL;
+		std::memcpy(m, mem, oldb);
+		releaseLarge(mem, oldb);
+		return m;
+#endif
+#endif
+	}
 
 	static void *malloc(size_t size) {
 		if(size == 0)
 			return NULL;
 		if(size <= blockEnd) {
-			size = blockNearest(size);
-			// try allocating from the top arena
-			void *m = arenaList->allocateBlock(size);
-			if(m)
-				return m;
-			// try allocating from the next arenas
-			Arena *current = arenaList;
-			while(current->nextArena) {
-				Arena *parent = current;
-				current       = current->nextArena;
-				m             = current->allocateBlock(size);
-				if(m) {
-					// put this arena to the front
-					parent->nextArena  = current->nextArena;
-					current->nextArena = arenaList;
-					arenaList          = current;
-					return m;
-				}
-			}
-			// we reached the end, so we need a new arena
-			Arena *a     = Arena::create();
-			a->nextArena = arenaList;
-			arenaList    = a;
-			return a->allocateBlock(size); // we're sure we can do this
+			size        = blockNearest(size);
+			Magazine &m = threadCache().magazines[getSizeClass(size)];
+			if(m.count == 0)
+				threadCache().refill(m, size);
+			return m.blocks[--m.count];
 		}
-		void *m = std::malloc(size);
+		void *m = size < largeObjectSize ? std::malloc(size)
+		                                 : allocateLarge(size, false);
 		if(m == NULL) {
 			Printer::Err("Memory unavailable for allocation!");
 		}
@@ -322,19 +478,24 @@ struct MemoryManager {
 		if(oldb == 0 || mem == NULL) {
 			return MemoryManager::malloc(newb);
 		}
-		if(oldb > blockEnd && newb > blockEnd) {
-			void *m = std::realloc(mem, newb);
-			if(newb > 0 && m == NULL) {
-				Printer::Err("Realloc failed!");
-				exit(1);
-			}
-			return m;
+		void *m = NULL;
+		if(oldb >= largeObjectSize && newb >= largeObjectSize) {
+			m = reallocateLarge(mem, oldb, newb);
+		} else if(oldb > blockEnd && newb > blockEnd &&
+		          oldb < largeObjectSize && newb < largeObjectSize) {
+			m = std::realloc(mem, newb);
+		} else {
+			void * nmem = MemoryManager::malloc(newb);
+			size_t cp   = oldb < newb ? oldb : newb;
+			std::memcpy(nmem, mem, cp);
+			MemoryManager::free(mem, oldb);
+			return nmem;
 		}
-		void * nmem = MemoryManager::malloc(newb);
-		size_t cp   = oldb < newb ? oldb : newb;
-		std::memcpy(nmem, mem, cp);
-		MemoryManager::free(mem, oldb);
-		return nmem;
+		if(m == NULL) {
+			Printer::Err("Realloc failed!");
+			exit(1);
+		}
+		return m;
 	}
 
 	static void *calloc(size_t num, size_t bytes) {
@@ -343,7 +504,9 @@ struct MemoryManager {
 			std::memset(mem, 0, num * bytes);
 			return mem;
 		}
-		void *m = std::calloc(num, bytes);
+		void *m = num * bytes < largeObjectSize
+		              ? std::calloc(num, bytes)
+		              : allocateLarge(num * bytes, true);
 		if(num * bytes > 0 && m == NULL) {
 			Printer::Err("Calloc failed!");
 			exit(1);
@@ -355,38 +518,30 @@ struct MemoryManager {
 		if(mem == NULL)
 			return;
 		if(size <= blockEnd) {
-			size       = blockNearest(size);
-			Arena *a   = arenaList;
-			size_t cls = getSizeClass(size);
-			// if it is already in the first arena,
-			// we cool
-			if(mem >= a->beginMemory && mem <= a->endMemory) {
-				a->releaseBlock(mem, cls);
-				return;
-			}
-			Arena *arenaParent = a;
-			a                  = a->nextArena;
-			while(a) {
-				// check the boundary where m should place
-				if(mem >= a->beginMemory && mem <= a->endMemory) {
-					a->releaseBlock(mem, cls);
-					// we're going to put this arena in the
-					// front of the queue, which we know it
-					// isn't already
-					arenaParent->nextArena = a->nextArena;
-					a->nextArena           = arenaList;
-					arenaList              = a;
-					return;
-				}
-				arenaParent = a;
-				a           = a->nextArena;
-			}
-		} else {
+			size        = blockNearest(size);
+			Magazine &m = threadCache().magazines[getSizeClass(size)];
+			if(m.count == magazineSize * 2)
+				threadCache().release(m, size, magazineSize);
+			m.blocks[m.count++] = mem;
+		} else if(size < largeObjectSize) {
 			std::free(mem);
+		} else {
+			releaseLarge(mem, size);
 		}
 	}
 
+	// releases a block of 'size' bytes, which must be a
+	// multiple of blockWidth, to its arena
+	static void releaseBlock(void *mem, size_t size) {
+		Pool *p = poolOf(mem);
+		p->arena->releaseBlock(p, mem, getSizeClass(size));
+	}
+
 	static void releaseArenas() {
+		// the blocks cached by this thread keep their
+		// pools alive, so give them back first
+		threadCache().flush();
+		std::lock_guard<std::mutex> l(arenaLock);
 		Arena *a           = arenaList;
 		Arena *arenaParent = nullptr;
 		while(a) {
@@ -410,12 +565,79 @@ struct MemoryManager {
 		}
 	}
 
+	// finds the number of bytes handed out from the pools,
+	// and the number of bytes of pools which are resident
+	static void usage(size_t &used, size_t &resident) {
+		std::lock_guard<std::mutex> l(arenaLock);
+		used = resident = 0;
+		for(Arena *a = arenaList; a; a = a->nextArena) {
+			for(size_t i = 0; i < blockCount; i++) {
+				for(Pool *p = a->pools[i]; p; p = p->nextPool)
+					used += (poolNumAvailBlocks[i] - p->numAvailBlocks) *
+					        p->blockSize;
+			}
+			size_t carved =
+			    (a->lastPoolBlock + poolSize - (char *)a->beginMemory) /
+			    poolSize;
+			resident += carved * poolSize;
+			for(Pool *p = a->freePools; p; p = p->nextPool)
+				if(p->trimmed)
+					resident -= poolSize - pageSize;
+		}
+	}
+
+	// gives the pages of the free pools back to the OS, so that
+	// a few live blocks pinning an arena do not keep all of its
+	// memory resident. the first page of a pool holds its
+	// header, which keeps it in the free list, so that stays.
+	// the cached large spans are given back too. returns the
+	// number of bytes given back.
+	static size_t trim() {
+#ifdef _WIN32
+		return 0;
+#else
+		if(pageSize >= poolSize)
+			return 0;
+		// the cached blocks keep their pools alive
+		threadCache().flush();
+		size_t released = 0;
+		{
+			std::lock_guard<std::mutex> l(arenaLock);
+			for(Arena *a = arenaList; a; a = a->nextArena) {
+				for(Pool *p = a->freePools; p; p = p->nextPool) {
+					if(p->trimmed)
+						continue;
+					madvise((char *)p + pageSize, poolSize - pageSize,
+					        MADV_DONTNEED);
+					p->trimmed = true;
+					released += poolSize - pageSize;
+				}
+			}
+		}
+		std::lock_guard<std::mutex> l(largeLock);
+		for(size_t i = 0; i < largeCacheCount; i++) {
+			Span &s = largeCache[i];
+			if(!s.resident)
+				continue;
+			madvise(s.mem, s.pages * pageSize, MADV_DONTNEED);
+			s.resident = false;
+			largeCacheResident -= s.pages * pageSize;
+			released += s.pages * pageSize;
+		}
+		return released;
+#endif
+	}
+
 	// initialize one arena in the beginning
 	static void init() {
 		arenaList = Arena::create();
+#ifndef _WIN32
+		pageSize = sysconf(_SC_PAGESIZE);
+#endif
 		// initialize pool blockCount
 		for(size_t i = 0; i < blockCount; i++) {
-			poolNumAvailBlocks[i] = poolSize / (blockWidth * (i + 1));
+			poolNumAvailBlocks[i] =
+			    (poolSize - poolHeaderSize) / (blockWidth * (i + 1));
 		}
 	}
 };
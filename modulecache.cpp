@@ -0,0 +1,704 @@
+#include "modulecache.h"
+#include "filesystem/path.h"
+#include "objects/bytecodecompilationctx.h"
+#include "objects/class.h"
+#include "objects/classcompilationctx.h"
+#include "objects/classes.h"
+#include "objects/customarray.h"
+#include "objects/function.h"
+#include "objects/symtab.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/stat.h>
+
+// cache format
+// ------------
+// header: magic, version, interpreter key, source length,
+//         source hash, body hash
+// body:   strings, classes, function headers, function bodies,
+//         class symbols
+// every integer is stored in the byte order of the machine,
+// since the key already differs between interpreters.
+static const uint32_t Magic = 0x4354584E; // NXTC
+
+// the kinds of the operands of each opcode. the symbols are
+// stored as the indices of their names in the string table.
+enum OperandKind : uint8_t {
+	OPERAND_none,
+	OPERAND_int,
+	OPERAND_Value,
+	OPERAND_symbol
+};
+
+static const OperandKind OperandKinds[][2] = {
+#define OPCODE0(x, y) {OPERAND_none, OPERAND_none},
+#define OPCODE1(x, y, z) {OPERAND_##z, OPERAND_none},
+#define OPCODE2(w, x, y, z) {OPERAND_##y, OPERAND_##z},
+#include "opcodes.h"
+};
+
+static const size_t NumOpcodes = sizeof(OperandKinds) / sizeof(OperandKinds[0]);
+
+static OperandKind operandKind(int opcode, int operand) {
+	if(operand == 0) {
+		switch(opcode) {
+			case Bytecode::CODE_copy:
+			case Bytecode::CODE_call_soft:
+			case Bytecode::CODE_call:
+			case Bytecode::CODE_call_intra:
+			case Bytecode::CODE_call_method:
+			case Bytecode::CODE_call_method_super:
+			case Bytecode::CODE_load_field:
+			case Bytecode::CODE_store_field:
+			case Bytecode::CODE_load_method:
+			case Bytecode::CODE_search_method: return OPERAND_symbol;
+			default: break;
+		}
+	}
+	return OperandKinds[opcode][operand];
+}
+
+// kinds of the values in the constants and the method buffers
+enum ValueKind : uint8_t {
+	VALUE_raw, // anything which is not a gc object, stored as is
+	VALUE_string,
+	VALUE_class,
+	VALUE_function
+};
+
+// fnv-1a
+static uint64_t hashBytes(const void *data, size_t size,
+                          uint64_t h = 0xcbf29ce484222325) {
+	const uint8_t *b = (const uint8_t *)data;
+	for(size_t i = 0; i < size; i++) {
+		h ^= b[i];
+		h *= 0x100000001b3;
+	}
+	return h;
+}
+
+// identifies the interpreter which wrote the cache. a cache is
+// only valid for the same opcodes, code generator options and
+// interpreter binary.
+static uint64_t interpreterKey() {
+	static uint64_t key = 0;
+	if(key != 0)
+		return key;
+	uint64_t h = hashBytes(&ModuleCache::Version, sizeof(uint32_t));
+	for(size_t i = 0; i < NumOpcodes; i++) {
+		h = hashBytes(Bytecode::OpcodeNames[i],
+		              strlen(Bytecode::OpcodeNames[i]), h);
+		h = hashBytes(OperandKinds[i], sizeof(OperandKinds[i]), h);
+	}
+	// the code generator folds the constants unless
+	// NEXT_NO_FOLD is set
+	bool fold = std::getenv("NEXT_NO_FOLD") == nullptr;
+	h         = hashBytes(&fold, sizeof(fold), h);
+	// the binary is identified by its size and modification
+	// time, where they can be found
+	struct stat st;
+	if(stat("/proc/self/exe", &st) == 0) {
+		int64_t stamp[] = {(int64_t)st.st_size, (int64_t)st.st_mtime};
+		h               = hashBytes(stamp, sizeof(stamp), h);
+	}
+	return key = h;
+}
+
+static bool isEnabled() {
+	static const bool enabled = std::getenv("NEXT_NO_CACHE") == nullptr;
+	return enabled;
+}
+
+static std::string cachePath(const String2 &fileName, String *moduleName) {
+	filesystem::path source((const char *)fileName->strb());
+	std::string      name((const char *)moduleName->strb(), moduleName->size);
+	const char *     dir = std::getenv("NEXT_CACHE_DIR");
+	if(dir != nullptr) {
+		// modules with the same name from different directories
+		// are told apart by the hash of their paths
+		std::string abs  = source.make_absolute().str();
+		char        hash[20];
+		snprintf(hash, sizeof(hash), "-%016llx",
+		         (unsigned long long)hashBytes(abs.data(), abs.size()));
+		return (filesystem::path(dir) / filesystem::path(name + hash + ".nc"))
+		    .str();
+	}
+	filesystem::path parent = source.make_absolute().parent_path();
+	return (parent / filesystem::path("__nextcache__") /
+	        filesystem::path(name + ".nc"))
+	    .str();
+}
+
+namespace {
+
+struct CacheWriter {
+	// the body is written first, since the strings are only
+	// known once it is complete
+	CustomArray<uint8_t> body;
+
+	HashMap<String *, uint32_t> stringIndex;
+	CustomArray<String *>       strings;
+	HashMap<Class *, uint32_t>  classIndex;
+	CustomArray<Class *>        classes;
+	HashMap<Function *, int>    functionIndex;
+	CustomArray<Function *>     functions;
+
+	const char *source;
+	size_t      sourceLength;
+	const Class *classClass;
+	bool         failed;
+
+	CacheWriter(const void *s)
+	    : source((const char *)s), sourceLength(strlen(source)),
+	      classClass(Classes::get<Class>()), failed(false) {}
+
+	void bytes(CustomArray<uint8_t> &buf, const void *data, size_t size) {
+		buf.resize(buf.size + size);
+		memcpy(&buf.obj[buf.size], data, size);
+		buf.size += size;
+	}
+
+	template <typename T> void write(T v) { bytes(body, &v, sizeof(T)); }
+
+	uint32_t string(String *s) {
+		auto it = stringIndex.find(s);
+		if(it != stringIndex.end())
+			return it->second;
+		strings.insert(s);
+		return stringIndex[s] = strings.size - 1;
+	}
+
+	uint32_t symbol(int sym) { return string(SymbolTable2::getString(sym)); }
+
+	void addClass(Class *c) {
+		classIndex[c] = classes.size;
+		classes.insert(c);
+	}
+
+	void addFunction(Value v) {
+		if(!v.isFunction())
+			return;
+		Function *f = v.toFunction();
+		if(f->getType() == Function::BUILTIN) {
+			failed = true;
+			return;
+		}
+		if(!functionIndex.contains(f)) {
+			functionIndex[f] = functions.size;
+			functions.insert(f);
+		}
+	}
+
+	// the value of the symbol in the base class the metaclass
+	// is copied from, or nil
+	Value baseSymbol(int sym) {
+		if(sym < classClass->functions->size)
+			return classClass->functions->values[sym];
+		return ValueNil;
+	}
+
+	// the symbols of a metaclass are compared with its base,
+	// and only the ones it has added are stored
+	bool isStored(Class *c, int sym, bool meta) {
+		Value v = c->functions->values[sym];
+		if(v.isNil())
+			return false;
+		return !meta || v.val.value != baseSymbol(sym).val.value;
+	}
+
+	void collectFunctions(Class *c, bool meta) {
+		for(int i = 0; i < c->functions->size; i++) {
+			if(isStored(c, i, meta))
+				addFunction(c->functions->values[i]);
+		}
+	}
+
+	void value(Value v) {
+		if(!v.isGcObject()) {
+			write(VALUE_raw);
+			write(v.val.value);
+		} else if(v.isString()) {
+			write(VALUE_string);
+			write((uint64_t)string(v.toString()));
+		} else if(v.isClass() && classIndex.contains(v.toClass())) {
+			write(VALUE_class);
+			write((uint64_t)classIndex[v.toClass()]);
+		} else if(v.isFunction() && functionIndex.contains(v.toFunction())) {
+			write(VALUE_function);
+			write((uint64_t)functionIndex[v.toFunction()]);
+		} else {
+			failed = true;
+		}
+	}
+
+	void symbols(Class *c, bool meta) {
+		uint32_t count = 0;
+		for(int i = 0; i < c->functions->size; i++) count += isStored(c, i, meta);
+		write(count);
+		for(int i = 0; i < c->functions->size; i++) {
+			if(!isStored(c, i, meta))
+				continue;
+			write(symbol(i));
+			value(c->functions->values[i]);
+		}
+	}
+
+	void token(const Token &t) {
+		write((int32_t)t.type);
+		if(t.source.source == NULL) {
+			write((int64_t)-1);
+		} else {
+			const char *start = (const char *)t.start.source;
+			// tokens from any other source cannot be restored
+			if(t.source.source != source || start < source ||
+			   start > source + sourceLength) {
+				failed = true;
+				return;
+			}
+			write((int64_t)(start - source));
+		}
+		write((int32_t)t.length);
+		write((int32_t)t.line);
+	}
+
+	void code(Bytecode *b) {
+		write((int32_t)b->numSlots);
+		write((int32_t)b->stackSize);
+		write((int32_t)b->stackMaxSize);
+		write((uint32_t)b->num_values);
+		for(size_t i = 0; i < b->num_values; i++) {
+			write((uint8_t)b->reserved[i]);
+			value(b->values[i]);
+		}
+		write((uint32_t)b->size);
+		for(size_t ip = 0; ip < b->size;) {
+			int op = b->bytecodes[ip++];
+			write((int32_t)op);
+			for(int i = 0; i < Bytecode::OpcodeLengths[op] - 1; i++) {
+				int operand = b->bytecodes[ip++];
+				if(operandKind(op, i) == OPERAND_symbol)
+					operand = symbol(operand);
+				write((int32_t)operand);
+			}
+		}
+		BytecodeCompilationContext *ctx = b->ctx;
+		write((uint32_t)(ctx == NULL ? 0 : ctx->size));
+		for(size_t i = 0; ctx != NULL && i < ctx->size; i++) {
+			token(ctx->ranges_[i].token);
+			write((uint64_t)ctx->ranges_[i].range_);
+		}
+	}
+
+	void function(Function *f) {
+		code(f->code);
+		write((uint32_t)f->numExceptions);
+		for(size_t i = 0; i < f->numExceptions; i++) {
+			Exception &e = f->exceptions[i];
+			write((int32_t)e.from);
+			write((int32_t)e.to);
+			write((uint32_t)e.numCatches);
+			for(size_t j = 0; j < e.numCatches; j++) {
+				write((int32_t)e.catches[j].slot);
+				write((int32_t)e.catches[j].jump);
+				write((int32_t)e.catches[j].type);
+			}
+		}
+	}
+
+	void module(ClassCompilationContext *ctx) {
+		addClass(ctx->get_class());
+		for(auto &c : ctx->cctxMap->vv)
+			addClass(c.second.toClassCompilationContext()->get_class());
+		for(size_t i = 0; i < classes.size; i++) {
+			collectFunctions(classes.obj[i], false);
+			if(i > 0)
+				collectFunctions(classes.obj[i]->metaclass, true);
+		}
+
+		write((uint32_t)classes.size);
+		for(size_t i = 0; i < classes.size; i++) {
+			Class *c = classes.obj[i];
+			write(string(c->name));
+			write((int32_t)c->numSlots);
+			// a module has no static members, and shares its
+			// union with them
+			write((int32_t)(i > 0 ? c->static_slot_count : 0));
+			write((uint32_t)c->staticRefCount);
+			for(int j = 0; j < c->staticRefCount; j++) {
+				// the refs to the other classes are only added
+				// when a class is derived at runtime
+				if(c->staticRefs[j].owner != c)
+					failed = true;
+				write((int32_t)c->staticRefs[j].slot);
+			}
+		}
+		write((uint32_t)functions.size);
+		for(size_t i = 0; i < functions.size; i++) {
+			Function *f = functions.obj[i];
+			write(string(f->name));
+			write((int32_t)f->arity);
+			write((uint8_t)f->isStatic());
+			write((uint8_t)f->isVarArg());
+		}
+		for(size_t i = 0; i < functions.size; i++) function(functions.obj[i]);
+		for(size_t i = 0; i < classes.size; i++) {
+			symbols(classes.obj[i], false);
+			if(i > 0)
+				symbols(classes.obj[i]->metaclass, true);
+		}
+	}
+
+	// returns the contents of the cache file
+	void finish(CustomArray<uint8_t> &out) {
+		CustomArray<uint8_t> table;
+		uint32_t             count = strings.size;
+		bytes(table, &count, sizeof(count));
+		for(size_t i = 0; i < strings.size; i++) {
+			uint32_t size = strings.obj[i]->size;
+			bytes(table, &size, sizeof(size));
+			bytes(table, strings.obj[i]->strb(), size);
+		}
+		uint64_t header[] = {((uint64_t)ModuleCache::Version << 32) | Magic,
+		                     interpreterKey(), sourceLength,
+		                     hashBytes(source, sourceLength),
+		                     hashBytes(body.obj, body.size,
+		                               hashBytes(table.obj, table.size))};
+		bytes(out, header, sizeof(header));
+		bytes(out, table.obj, table.size);
+		bytes(out, body.obj, body.size);
+	}
+};
+
+struct Input {
+	const uint8_t *ptr, *end;
+	bool           failed;
+
+	Input(const uint8_t *p, size_t size)
+	    : ptr(p), end(p + size), failed(false) {}
+
+	const uint8_t *bytes(size_t size) {
+		if(failed || (size_t)(end - ptr) < size) {
+			failed = true;
+			return NULL;
+		}
+		const uint8_t *ret = ptr;
+		ptr += size;
+		return ret;
+	}
+
+	template <typename T> T read() {
+		T              v = T();
+		const uint8_t *b = bytes(sizeof(T));
+		if(b != NULL)
+			memcpy(&v, b, sizeof(T));
+		return v;
+	}
+
+	size_t remaining() { return end - ptr; }
+
+	// reads an index, and verifies that it is less than 'count'
+	template <typename T> size_t index(size_t count) {
+		size_t i = read<T>();
+		if(i >= count) {
+			failed = true;
+			return 0;
+		}
+		return i;
+	}
+};
+
+struct CacheReader {
+	Input       in;
+	const char *source;
+	size_t      sourceLength;
+	const void *file;
+	Array2      strings;
+	Array2      classes;
+	Array2      functions;
+
+	CacheReader(const uint8_t *b, size_t size, const char *s, const void *f)
+	    : in(b, size), source(s), sourceLength(strlen(s)), file(f),
+	      strings(Array::create(1)), classes(Array::create(1)),
+	      functions(Array::create(1)) {}
+
+	// returns NULL if the index is invalid
+	String *string() {
+		size_t i = in.index<uint32_t>(strings->size);
+		return in.failed ? NULL : strings->values[i].toString();
+	}
+
+	Value value() {
+		uint8_t  kind = in.read<uint8_t>();
+		uint64_t v    = in.read<uint64_t>();
+		switch(kind) {
+			case VALUE_raw: return Value(Value::ValueUnion(v));
+			case VALUE_string:
+				if(v < (uint64_t)strings->size)
+					return strings->values[v];
+				break;
+			case VALUE_class:
+				if(v < (uint64_t)classes->size)
+					return classes->values[v];
+				break;
+			case VALUE_function:
+				if(v < (uint64_t)functions->size)
+					return functions->values[v];
+				break;
+		}
+		in.failed = true;
+		return ValueNil;
+	}
+
+	Token token() {
+		Token t;
+		t.type         = (Token::Type)in.read<int32_t>();
+		int64_t offset = in.read<int64_t>();
+		t.length       = in.read<int32_t>();
+		t.line         = in.read<int32_t>();
+		if(offset < 0)
+			return Token::PlaceholderToken;
+		if(offset > (int64_t)sourceLength)
+			in.failed = true;
+		else {
+			t.start    = Utf8Source(source + offset);
+			t.source   = Utf8Source(source);
+			t.fileName = Utf8Source(file);
+		}
+		return t;
+	}
+
+	void code(Bytecode *b) {
+		b->numSlots     = in.read<int32_t>();
+		b->stackSize    = in.read<int32_t>();
+		b->stackMaxSize = in.read<int32_t>();
+		uint32_t count  = in.read<uint32_t>();
+		if(in.failed || count > in.remaining())
+			return;
+		for(uint32_t i = 0; i < count && !in.failed; i++) {
+			bool reserved = in.read<uint8_t>();
+			b->add_constant(value(), false);
+			b->reserved[i] = reserved;
+		}
+		uint32_t size = in.read<uint32_t>();
+		if(in.failed || size > in.remaining() / 4)
+			return;
+		Gc_free(b->bytecodes, sizeof(Bytecode::Opcode) * b->capacity);
+		b->bytecodes =
+		    (Bytecode::Opcode *)Gc_malloc(sizeof(Bytecode::Opcode) * size);
+		b->capacity = size;
+		b->size     = size;
+		for(size_t ip = 0; ip < size && !in.failed;) {
+			size_t op            = in.index<int32_t>(NumOpcodes);
+			b->bytecodes[ip++]   = (Bytecode::Opcode)op;
+			size_t operands      = Bytecode::OpcodeLengths[op] - 1;
+			if(ip + operands > size) {
+				in.failed = true;
+				break;
+			}
+			for(size_t i = 0; i < operands; i++) {
+				int operand = 0;
+				switch(operandKind(op, i)) {
+					case OPERAND_symbol: {
+						String *sym = string();
+						if(sym != NULL)
+							operand = SymbolTable2::insert(sym);
+						break;
+					}
+					case OPERAND_Value:
+						operand = in.index<int32_t>(b->num_values);
+						break;
+					default: operand = in.read<int32_t>(); break;
+				}
+				b->bytecodes[ip++] = (Bytecode::Opcode)operand;
+			}
+		}
+		BytecodeCompilationContext *ctx    = b->ctx;
+		uint32_t                    tokens = in.read<uint32_t>();
+		if(in.failed || tokens > in.remaining() / 28)
+			return;
+		if(tokens > 0) {
+			Gc_free(ctx->ranges_,
+			        sizeof(BytecodeCompilationContext::TokenRange) *
+			            ctx->capacity);
+			ctx->ranges_ = (BytecodeCompilationContext::TokenRange *)Gc_malloc(
+			    sizeof(BytecodeCompilationContext::TokenRange) * tokens);
+			ctx->capacity = tokens;
+		}
+		for(uint32_t i = 0; i < tokens; i++) {
+			ctx->ranges_[i].token  = token();
+			ctx->ranges_[i].range_ = in.read<uint64_t>();
+		}
+		ctx->size = tokens;
+	}
+
+	void function(Function *f) {
+		code(f->code);
+		uint32_t count = in.read<uint32_t>();
+		if(in.failed || count > in.remaining() / 12)
+			return;
+		f->exceptions = (Exception *)Gc_malloc(sizeof(Exception) * count);
+		f->numExceptions = count;
+		// the function is released as usual if the cache turns
+		// out to be invalid
+		std::fill_n(f->exceptions, count, Exception{0, NULL, 0, 0});
+		for(uint32_t i = 0; i < count && !in.failed; i++) {
+			Exception &e   = f->exceptions[i];
+			e.from         = in.read<int32_t>();
+			e.to           = in.read<int32_t>();
+			size_t catches = in.read<uint32_t>();
+			if(in.failed || catches > in.remaining() / 12)
+				break;
+			e.numCatches = catches;
+			e.catches = (CatchBlock *)Gc_malloc(sizeof(CatchBlock) * catches);
+			for(size_t j = 0; j < e.numCatches; j++) {
+				e.catches[j].slot = in.read<int32_t>();
+				e.catches[j].jump = in.read<int32_t>();
+				e.catches[j].type =
+				    (CatchBlock::SlotType)in.index<int32_t>(
+				        CatchBlock::MODULE_SUPER + 1);
+			}
+		}
+	}
+
+	void symbols(Class *c) {
+		uint32_t count = in.read<uint32_t>();
+		for(uint32_t i = 0; i < count && !in.failed; i++) {
+			String *sym = string();
+			Value   v   = value();
+			if(!in.failed)
+				c->add_sym(SymbolTable2::insert(sym), v);
+		}
+	}
+
+	Class *module(String *moduleName) {
+		uint32_t count = in.read<uint32_t>();
+		for(uint32_t i = 0; i < count && !in.failed; i++) {
+			String *name      = string();
+			int     numSlots  = in.read<int32_t>();
+			int     numStatic = in.read<int32_t>();
+			if(in.failed)
+				break;
+			Class2 c = Class::create();
+			classes->insert(c);
+			if(i == 0) {
+				// the module is named after the file it is
+				// loaded from
+				c->init_class(moduleName, Class::ClassType::NORMAL);
+			} else {
+				// same as ClassCompilationContext::create
+				Class *metaclass = Classes::get<Class>()->copy();
+				c->obj.setClass(metaclass);
+				metaclass->name = String::append(name, " metaclass");
+				c->init_class(name, Class::ClassType::NORMAL, metaclass);
+				c->module = classes->values[0].toClass();
+			}
+			c->numSlots = numSlots;
+			for(int j = 0; j < numStatic && !in.failed; j++)
+				c->add_static_slot();
+			uint32_t refs = in.read<uint32_t>();
+			for(uint32_t j = 0; j < refs && !in.failed; j++)
+				c->add_static_ref(c, in.index<int32_t>(c->static_slot_count));
+		}
+		if(count == 0)
+			in.failed = true;
+
+		count = in.read<uint32_t>();
+		for(uint32_t i = 0; i < count && !in.failed; i++) {
+			String *  name     = string();
+			int       arity    = in.read<int32_t>();
+			bool      isStatic = in.read<uint8_t>();
+			bool      isVarArg = in.read<uint8_t>();
+			if(in.failed)
+				break;
+			Function2 f = Function::create(name, arity, isVarArg, isStatic);
+			functions->insert(f);
+			f->code = BytecodeCompilationContext::create()->code;
+		}
+		for(int i = 0; i < functions->size && !in.failed; i++)
+			function(functions->values[i].toFunction());
+
+		for(int i = 0; i < classes->size && !in.failed; i++) {
+			Class *c = classes->values[i].toClass();
+			symbols(c);
+			if(i > 0)
+				symbols(c->metaclass);
+		}
+		if(in.failed || in.ptr != in.end)
+			return NULL;
+		return classes->values[0].toClass();
+	}
+};
+
+} // namespace
+
+Class *ModuleCache::load(const String2 &fileName, String *moduleName,
+                         const void *source, const void *file) {
+	if(!isEnabled() || source == NULL)
+		return NULL;
+	std::string path = cachePath(fileName, moduleName);
+	FILE *      f    = fopen(path.c_str(), "rb");
+	if(f == NULL)
+		return NULL;
+	fseek(f, 0, SEEK_END);
+	long size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	if(size < 0) {
+		fclose(f);
+		return NULL;
+	}
+	uint8_t *buffer = (uint8_t *)Gc_malloc(size);
+	size_t   read   = fread(buffer, 1, size, f);
+	fclose(f);
+
+	Class *        ret          = NULL;
+	const char *   src          = (const char *)source;
+	size_t         sourceLength = strlen(src);
+	const size_t   headerSize   = sizeof(uint64_t) * 5;
+	const uint64_t *header      = (const uint64_t *)buffer;
+	if(read == (size_t)size && read >= headerSize &&
+	   header[0] == (((uint64_t)Version << 32) | Magic) &&
+	   header[1] == interpreterKey() && header[2] == sourceLength &&
+	   header[3] == hashBytes(src, sourceLength) &&
+	   header[4] == hashBytes(buffer + headerSize, read - headerSize)) {
+		CacheReader l(buffer + headerSize, read - headerSize, src, file);
+		uint32_t count = l.in.read<uint32_t>();
+		for(uint32_t i = 0; i < count && !l.in.failed; i++) {
+			uint32_t       length = l.in.read<uint32_t>();
+			const uint8_t *str    = l.in.bytes(length);
+			if(str != NULL)
+				l.strings->insert(String::from(str, length));
+		}
+		ret = l.module(moduleName);
+	}
+	Gc_free(buffer, size);
+	return ret;
+}
+
+void ModuleCache::store(const String2 &fileName, ClassCompilationContext *ctx,
+                        const void *source) {
+	if(!isEnabled() || source == NULL)
+		return;
+	CacheWriter w(source);
+	w.module(ctx);
+	if(w.failed)
+		return;
+	CustomArray<uint8_t> out;
+	w.finish(out);
+
+	std::string      path = cachePath(fileName, ctx->get_class()->name);
+	filesystem::path dir  = filesystem::path(path).parent_path();
+	if(!dir.exists())
+		filesystem::create_directory(dir);
+	// the file is written in place only once it is complete, so
+	// that a reader never sees a partial cache
+	std::string temp = path + ".tmp";
+	FILE *      f    = fopen(temp.c_str(), "wb");
+	if(f == NULL)
+		return;
+	bool written = fwrite(out.obj, 1, out.size, f) == out.size;
+	if(fclose(f) == 0 && written && rename(temp.c_str(), path.c_str()) == 0)
+		return;
+	remove(temp.c_str());
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "objects/string.h"
+
+struct Class;
+struct ClassCompilationContext;
+
+// compiled module cache
+// ---------------------
+// once a module is compiled from a file, its classes and
+// functions are written to a cache file, which is loaded
+// instead of compiling the module again, as long as neither
+// the source nor the interpreter has changed. the symbols in
+// the bytecode are stored by their names, and the tokens by
+// their offsets in the source, which is still read to verify
+// the cache, and to highlight the errors.
+//
+// the cache of 'dir/mod.n' is stored in
+// 'dir/__nextcache__/mod.nc', or in the directory named by
+// NEXT_CACHE_DIR, if set. NEXT_NO_CACHE disables it.
+struct ModuleCache {
+	// bumped whenever the format, or the code generated for
+	// the same source, changes
+	static const uint32_t Version = 1;
+
+	// returns the module class loaded from the cache of the file,
+	// or NULL if there is no valid cache for 'source'. 'file' is
+	// the name the tokens will refer to.
+	static Class *load(const String2 &fileName, String *moduleName,
+	                   const void *source, const void *file);
+	// writes the module compiled from 'source' to the cache of
+	// the file. nothing is written if the module contains
+	// something which cannot be cached.
+	static void store(const String2 &fileName, ClassCompilationContext *ctx,
+	                  const void *source);
+};
@@ -54,8 +54,10 @@ Value next_array_set(const Value *args, int numargs) {
 		i += a->size;
 	}
 	if(i >= 0 && i <= a->size) {
-		if(i < a->size)
+		if(i < a->size) {
+			Gc::writeBarrier(a, args[2]);
 			return a->values[i] = args[2];
+		}
 		else
 			return a->insert(args[2]);
 	}
@@ -132,6 +134,7 @@ Value &Array::insert(Value v) {
 	if(size == capacity) {
 		resize(capacity + 1);
 	}
+	Gc::writeBarrier(this, v);
 	return values[size++] = v;
 }
 
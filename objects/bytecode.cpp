@@ -1,9 +1,16 @@
 #include "bytecode.h"
+#include "../printer.h"
 #include "../utils.h"
+#include "bytecodecompilationctx.h"
 #include "class.h"
+#include "customarray.h"
+#include "function.h"
 #include "string.h"
 #include "symtab.h"
 
+#include <algorithm>
+#include <cstdlib>
+
 #ifdef DEBUG
 #include "../format.h"
 #endif
@@ -15,7 +22,19 @@ const char *Bytecode::OpcodeNames[] = {
 #include "../opcodes.h"
 };
 
+const uint8_t Bytecode::OpcodeLengths[] = {
+#define OPCODE0(x, y) 1,
+#define OPCODE1(x, y, z) 2,
+#define OPCODE2(w, x, y, z) 3,
+#include "../opcodes.h"
+};
+
 void Bytecode::push_back(Opcode code) {
+#ifdef NEXT_USE_JIT
+	// the repl keeps appending to the same bytecode
+	if(jit != nullptr)
+		Jit::release(this);
+#endif
 	if(size == capacity) {
 		size_t newcap = Utils::nextAllocationSize(capacity, size + 1);
 		bytecodes = (Opcode *)Gc_realloc(bytecodes, sizeof(Opcode) * capacity,
@@ -25,12 +44,193 @@ void Bytecode::push_back(Opcode code) {
 	bytecodes[size++] = code;
 }
 
-void Bytecode::finalize() {
-	if(size != capacity - 1) {
-		bytecodes = (Opcode *)Gc_realloc(bytecodes, sizeof(Opcode) * capacity,
-		                                 sizeof(Opcode) * size);
-		capacity  = size;
+// peephole optimizer
+// -----------------
+// the jumps which land on another jump are retargeted to its
+// target, and the following sequences are then removed:
+//      jump +2                         (a jump to the next opcode)
+//      <pure load>, pop                (push, pushn, load_slot...)
+//      store_slot_pop x, load_slot x   (replaced by store_slot x)
+// two opcodes are only combined if no jump lands in between
+// them, and if the first one is not read by the opcode before
+// it, like the store following an <op>_sss.
+
+// stores the position of the relative offset of the opcode
+// at 'ip' in 'operand', and returns true, if it has one
+static bool jumpOperand(const Bytecode::Opcode *code, size_t ip,
+                        size_t *operand) {
+	switch(code[ip]) {
+		case Bytecode::CODE_jump:
+		case Bytecode::CODE_jumpiftrue:
+		case Bytecode::CODE_jumpiffalse:
+		case Bytecode::CODE_land:
+		case Bytecode::CODE_lor:
+#define ITERATOR(x, y) case Bytecode::CODE_iterate_next_builtin_##x:
+#include "iterator_types.h"
+		case Bytecode::CODE_iterate_next_object_method:
+		case Bytecode::CODE_iterate_next_object_builtin:
+			*operand = ip + 1;
+			return true;
+		// points to the iterate_next of the loop
+		case Bytecode::CODE_iterator_verify: *operand = ip + 2; return true;
+		default: return false;
+	}
+}
+
+// opcodes which push a value without any side effect
+static bool isPureLoad(Bytecode::Opcode op) {
+	switch(op) {
+		case Bytecode::CODE_push:
+		case Bytecode::CODE_pushn:
+		case Bytecode::CODE_load_slot_0:
+		case Bytecode::CODE_load_slot_1:
+		case Bytecode::CODE_load_slot_2:
+		case Bytecode::CODE_load_slot_3:
+		case Bytecode::CODE_load_slot_4:
+		case Bytecode::CODE_load_slot_5:
+		case Bytecode::CODE_load_slot_6:
+		case Bytecode::CODE_load_slot_7:
+		case Bytecode::CODE_load_slot:
+		case Bytecode::CODE_load_object_slot:
+		case Bytecode::CODE_load_static_slot:
+		case Bytecode::CODE_load_module:
+		case Bytecode::CODE_load_module_super:
+		case Bytecode::CODE_load_module_core: return true;
+		default: return false;
+	}
+}
+
+// returns the slot accessed by the opcode, if it is one of
+// the given family, -1 otherwise
+static int slotOf(const Bytecode::Opcode *ins, Bytecode::Opcode first,
+                  Bytecode::Opcode generic) {
+	if(ins[0] >= first && ins[0] < first + 8)
+		return ins[0] - first;
+	if(ins[0] == generic)
+		return ins[1];
+	return -1;
+}
+
+// the <op>_sss opcodes perform the following store by themselves
+static bool readsNext(Bytecode::Opcode op) {
+	switch(op) {
+#define REGISTER_OPCODE(x) case Bytecode::CODE_##x##_sss:
+#include "../register_opcodes.h"
+		return true;
+		default: return false;
+	}
+}
+
+size_t Bytecode::finalize(Function *f) {
+	if(size == 0)
+		return 0;
+	const size_t MaxHops = 8;
+	for(size_t ip = 0; ip < size; ip += OpcodeLengths[bytecodes[ip]]) {
+		Opcode op = bytecodes[ip];
+		if(op != CODE_jump && op != CODE_jumpiftrue &&
+		   op != CODE_jumpiffalse && op != CODE_land && op != CODE_lor)
+			continue;
+		size_t target = ip + bytecodes[ip + 1];
+		for(size_t i = 0; i < MaxHops && target < size; i++) {
+			Opcode t = bytecodes[target];
+			// a short circuit finds the same value on the stack
+			// at another one of its kind
+			bool same = t == op && (op == CODE_land || op == CODE_lor);
+			if(t != CODE_jump && !same)
+				break;
+			target += bytecodes[target + 1];
+		}
+		bytecodes[ip + 1] = (Opcode)(int)(target - ip);
+	}
+	// mark the ips which are jumped to
+	CustomArray<bool> targets;
+	targets.resize(size + 1);
+	std::fill_n(targets.obj, size + 1, false);
+	size_t operand;
+	for(size_t ip = 0; ip < size; ip += OpcodeLengths[bytecodes[ip]]) {
+		if(jumpOperand(bytecodes, ip, &operand))
+			targets.obj[ip + bytecodes[operand]] = true;
+	}
+	for(size_t i = 0; i < f->numExceptions; i++) {
+		Exception &e          = f->exceptions[i];
+		targets.obj[e.from]   = true;
+		targets.obj[e.to + 1] = true;
+		for(size_t j = 0; j < e.numCatches; j++)
+			targets.obj[e.catches[j].jump] = true;
+	}
+	// the new ip of each of the old ones
+	CustomArray<size_t> ips;
+	ips.resize(size + 1);
+	// the new ips of the opcodes which are kept, and the old
+	// ips of the ones among them which jump
+	CustomArray<size_t> emitted, jumps;
+	Opcode *            code    = (Opcode *)Gc_malloc(sizeof(Opcode) * size);
+	size_t              out     = 0;
+	size_t              barrier = 0; // nothing before it is combined
+	size_t              total = 0, removed = 0;
+	for(size_t ip = 0, len = 0; ip < size; ip += len) {
+		Opcode op = bytecodes[ip];
+		len       = OpcodeLengths[op];
+		total++;
+		if(targets.obj[ip])
+			barrier = out;
+		Opcode *prev = nullptr;
+		if(!emitted.isEmpty() && emitted.last() >= barrier)
+			prev = &code[emitted.last()];
+		int slot = slotOf(&bytecodes[ip], CODE_load_slot_0, CODE_load_slot);
+		if(op == CODE_jump && bytecodes[ip + 1] == (int)len) {
+			removed++;
+		} else if(op == CODE_pop && prev != nullptr && isPureLoad(*prev)) {
+			out = emitted.popLast();
+			removed += 2;
+		} else if(prev != nullptr && slot != -1 &&
+		          slot == slotOf(prev, CODE_store_slot_pop_0,
+		                         CODE_store_slot_pop)) {
+			*prev = *prev == CODE_store_slot_pop
+			            ? CODE_store_slot
+			            : (Opcode)(CODE_store_slot_0 + slot);
+			removed++;
+		} else {
+			if(readsNext(op))
+				barrier = out + len + 1;
+			if(jumpOperand(bytecodes, ip, &operand))
+				jumps.insert(ip);
+			emitted.insert(out);
+			for(size_t i = 0; i < len; i++) {
+				ips.obj[ip + i] = out;
+				code[out++]     = bytecodes[ip + i];
+			}
+			continue;
+		}
+		// the removed opcodes continue to the next one
+		for(size_t i = 0; i < len; i++) ips.obj[ip + i] = out;
+	}
+	ips.obj[size] = out;
+	for(size_t ip : jumps) {
+		jumpOperand(bytecodes, ip, &operand);
+		size_t target = ip + bytecodes[operand];
+		code[ips.obj[ip] + operand - ip] =
+		    (Opcode)(int)(ips.obj[target] - ips.obj[ip]);
+	}
+	for(size_t i = 0; i < f->numExceptions; i++) {
+		Exception &e = f->exceptions[i];
+		e.from       = ips.obj[e.from];
+		e.to         = ips.obj[e.to + 1] - 1;
+		for(size_t j = 0; j < e.numCatches; j++)
+			e.catches[j].jump = ips.obj[e.catches[j].jump];
 	}
+	if(ctx != NULL)
+		ctx->relocate(ips.obj);
+	Gc_free(bytecodes, sizeof(Opcode) * capacity);
+	// shrink the opcode array to remove excess allocation
+	bytecodes = (Opcode *)Gc_realloc(code, sizeof(Opcode) * size,
+	                                 sizeof(Opcode) * out);
+	size = capacity = out;
+	static const bool report = std::getenv("NEXT_PEEPHOLE_STATS") != nullptr;
+	if(report)
+		Printer::println(Printer::StdErrStream, "[Peephole] ", f->name,
+		                 ": removed ", removed, " of ", total, " opcodes");
+	return removed;
 }
 
 size_t Bytecode::getip() {
@@ -61,6 +261,11 @@ Bytecode *Bytecode::create() {
 	code->numSlots     = 0;
 	code->values       = NULL;
 	code->num_values   = 0;
+	code->reserved     = NULL;
+#ifdef NEXT_USE_JIT
+	code->jit        = nullptr;
+	code->jitCounter = 0;
+#endif
 	return code;
 }
 
@@ -74,8 +279,25 @@ Bytecode *Bytecode::create_derived(int offset) {
 	b->ctx          = ctx;
 	for(Opcode *ip = bytecodes; ip - bytecodes < (int64_t)size;) {
 		Opcode o = *(ip++);
+		// the caches of the patched opcodes are stored in the
+		// values of this bytecode, so start them afresh
+		switch(o) {
+			case CODE_call_fast_builtin_soft:
+			case CODE_call_fast_method_soft:
+			case CODE_call_fast_builtin:
+			case CODE_call_fast_method:
+			case CODE_call_fast_poly:
+			case CODE_call_fast_mega: o = CODE_call_fast_prepare; break;
+			case CODE_load_field_slot:
+			case CODE_load_field_static:
+			case CODE_load_field_poly: o = CODE_load_field_fast; break;
+			case CODE_store_field_slot:
+			case CODE_store_field_static:
+			case CODE_store_field_poly: o = CODE_store_field_fast; break;
+			default: break;
+		}
 		if(o == CODE_load_object_slot || o == CODE_store_object_slot ||
-		   o == CODE_load_module || o == CODE_construct ||
+		   o == CODE_store_object_slot_pop || o == CODE_load_module || o == CODE_construct ||
 		   o == CODE_call_intra || o == CODE_call_method_super ||
 		   o == CODE_call_fast_prepare || o == CODE_bcall_fast_prepare ||
 		   o == CODE_load_field_fast || o == CODE_store_field_fast) {
@@ -86,6 +308,9 @@ Bytecode *Bytecode::create_derived(int offset) {
 				case CODE_store_object_slot:
 					b->store_object_slot(next_int() + offset);
 					break;
+				case CODE_store_object_slot_pop:
+					b->store_object_slot_pop(next_int() + offset);
+					break;
 				case CODE_load_module: b->load_module_super(); break;
 				case CODE_construct: (void)next_Value(); break;
 				case CODE_call_intra:
@@ -101,9 +326,7 @@ Bytecode *Bytecode::create_derived(int offset) {
 				}
 				case CODE_call_fast_prepare:
 					next_int(); // ignore the index
-					b->call_fast_prepare(b->add_constant(ValueNil, false),
-					                     next_int());
-					b->add_constant(ValueNil, false);
+					b->call_fast_prepare(b->add_call_cache(), next_int());
 					break;
 				case CODE_bcall_fast_prepare:
 					next_int(); // ignore the index
@@ -112,12 +335,12 @@ Bytecode *Bytecode::create_derived(int offset) {
 				case CODE_load_field_fast:
 					next_int(); // ignore the index
 					next_int(); // ignore the slot
-					b->load_field_fast(b->add_constant(ValueNil, false), 0);
+					b->load_field_fast(b->add_field_cache(), 0);
 					break;
 				case CODE_store_field_fast:
 					next_int(); // ignore the index
 					next_int(); // ignore the slot
-					b->store_field_fast(b->add_constant(ValueNil, false), 0);
+					b->store_field_fast(b->add_field_cache(), 0);
 					break;
 
 				default: break;
@@ -145,6 +368,10 @@ Bytecode *Bytecode::create_derived(int offset) {
 #undef relocip
 #undef next_int
 #undef next_Value
+	// the register opcodes reserve more stack than their
+	// effect for their slow paths
+	if(b->stackMaxSize < stackMaxSize)
+		b->stackMaxSize = stackMaxSize;
 	return b;
 }
 
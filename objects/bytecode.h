@@ -1,12 +1,14 @@
 #pragma once
 
 #include "../gc.h"
+#include "../jit.h"
 #include "../value.h"
 #include "array.h"
 
 #ifdef DEBUG
 struct WritableStream;
 #endif
+struct Function;
 
 struct Bytecode {
 	GcObject obj;
@@ -43,6 +45,18 @@ struct Bytecode {
 	// a gc.
 	Value *values;
 	size_t num_values;
+	// whether each of the values is reserved for a cache,
+	// which is patched at runtime, and must never be shared
+	// with a constant
+	bool *reserved;
+
+#ifdef NEXT_USE_JIT
+	// compiled machine code, see jit.h
+	Jit::Code *jit;
+	// number of times it has been entered, until it is
+	// compiled
+	size_t jitCounter;
+#endif
 
 #define OPCODE0(x, y)              \
 	size_t x() {                   \
@@ -105,23 +119,57 @@ struct Bytecode {
 	int add_constant(Value v, bool check = true) {
 		if(check) {
 			for(size_t i = 0; i < num_values; i++) {
-				if(values[i] == v)
+				if(!reserved[i] && values[i] == v)
 					return i;
 			}
 		}
-		values = (Value *)Gc_realloc(values, sizeof(Value) * num_values,
-		                             sizeof(Value) * (num_values + 1));
-		values[num_values] = v;
+		values   = (Value *)Gc_realloc(values, sizeof(Value) * num_values,
+		                               sizeof(Value) * (num_values + 1));
+		reserved = (bool *)Gc_realloc(reserved, sizeof(bool) * num_values,
+		                              sizeof(bool) * (num_values + 1));
+		values[num_values]   = v;
+		reserved[num_values] = !check;
 		num_values++;
 		return (num_values - 1);
 	}
 
+	// a call site caches up to CallCacheSize (class, function)
+	// pairs in the values, followed by the number of calls it
+	// has resolved from them, and the number it has not.
+	// the pairs are nil until they are filled.
+	static const int CallCacheSize   = 4;
+	static const int CallCacheHits   = 2 * CallCacheSize;
+	static const int CallCacheMisses = CallCacheHits + 1;
+	// returns the index of the first value of the cache
+	int add_call_cache() {
+		int idx = add_constant(ValueNil, false);
+		for(int i = 1; i < CallCacheHits; i++) add_constant(ValueNil, false);
+		add_constant(ValueZero, false);
+		add_constant(ValueZero, false);
+		return idx;
+	}
+
+	// a field access caches up to FieldCacheSize (class, slot)
+	// pairs in the values, for the classes which store the
+	// field in a slot of their instances
+	static const int FieldCacheSize = 4;
+	// returns the index of the first value of the cache
+	int add_field_cache() {
+		int idx = add_constant(ValueNil, false);
+		for(int i = 1; i < 2 * FieldCacheSize; i++)
+			add_constant(ValueNil, false);
+		return idx;
+	}
+
 	void stackEffect(int x);
 	void insertSlot();
 	void push_back(Opcode code);
-	// shrinks the opcode array to
-	// remove excess allocation
-	void finalize();
+	// runs the peephole optimizer over the code of 'f', see
+	// bytecode.cpp, and shrinks the opcode array to remove
+	// excess allocation. the catch blocks of 'f' and the tokens
+	// of the context are moved along with the opcodes. returns
+	// the number of opcodes removed.
+	size_t finalize(Function *f);
 
 	size_t           getip();
 	static Bytecode *create();
@@ -141,8 +189,12 @@ struct Bytecode {
 	}
 
 	void release() {
+#ifdef NEXT_USE_JIT
+		Jit::release(this);
+#endif
 		Gc_free(bytecodes, sizeof(Opcode) * capacity);
 		Gc_free(values, sizeof(Value) * num_values);
+		Gc_free(reserved, sizeof(bool) * num_values);
 	}
 
 	static void init(Class *c);
@@ -157,4 +209,21 @@ struct Bytecode {
 	void disassemble(WritableStream &os, const Opcode *o, size_t *ip = NULL);
 #endif
 	static const char *OpcodeNames[];
+	// length of each instruction, including its operands
+	static const uint8_t OpcodeLengths[];
 };
+
+#ifdef NEXT_USE_JIT
+inline bool Jit::hot(Bytecode *b) {
+	return b->jit != nullptr || count(b);
+}
+
+inline void *Jit::entry(Bytecode *b, const void *ip) {
+	if(b->jit == nullptr)
+		return nullptr;
+	size_t offset = (const Bytecode::Opcode *)ip - b->bytecodes;
+	if(offset >= b->jit->numEntries)
+		return nullptr;
+	return b->jit->entries[offset];
+}
+#endif
@@ -14,6 +14,7 @@ BytecodeCompilationContext *BytecodeCompilationContext::create() {
 	bcc->code              = Bytecode::create();
 	bcc->code->ctx         = bcc;
 	bcc->lastOpcode        = Bytecode::CODE_add;
+	bcc->lastOpcodePos     = 0;
 	return bcc;
 }
 
@@ -33,6 +34,34 @@ void BytecodeCompilationContext::insert_token(Token t) {
 	ranges_[size++].range_ = code->getip();
 }
 
+void BytecodeCompilationContext::discard(size_t ip) {
+	code->size = ip;
+	// the last token stores its absolute position, and the
+	// rest store their ranges
+	size_t start = 0, i = 0;
+	while(i + 1 < size && start + ranges_[i].range_ < ip)
+		start += ranges_[i++].range_;
+	if(i + 1 < size) {
+		size              = i + 1;
+		ranges_[i].range_ = start;
+	}
+	// nothing can be fused with the dropped code
+	lastOpcode = Bytecode::CODE_pop;
+}
+
+void BytecodeCompilationContext::relocate(const size_t *ips) {
+	// the last token stores its absolute position, and the
+	// rest store their ranges
+	size_t start = 0, moved = 0;
+	for(size_t i = 0; i + 1 < size; i++) {
+		start += ranges_[i].range_;
+		ranges_[i].range_ = ips[start] - moved;
+		moved             = ips[start];
+	}
+	if(size > 0)
+		ranges_[size - 1].range_ = ips[ranges_[size - 1].range_];
+}
+
 Token BytecodeCompilationContext::get_token(size_t ip) {
 	if(size == 0)
 		return Token::PlaceholderToken;
@@ -23,6 +23,7 @@ struct BytecodeCompilationContext {
 	size_t           capacity;
 	size_t           present_range;
 	Bytecode::Opcode lastOpcode;
+	size_t           lastOpcodePos;
 
 	// all methods defined in Bytecode will be
 	// redefined here with an overload that
@@ -30,7 +31,7 @@ struct BytecodeCompilationContext {
 #define OPCODE0(x, y)                             \
 	size_t x() {                                  \
 		lastOpcode = Bytecode::CODE_##x;          \
-		return code->x();                         \
+		return lastOpcodePos = code->x();         \
 	}                                             \
 	size_t x(size_t pos) { return code->x(pos); } \
 	size_t x(Token t) {                           \
@@ -40,7 +41,7 @@ struct BytecodeCompilationContext {
 #define OPCODE1(x, y, z)                                      \
 	size_t x(z arg) {                                         \
 		lastOpcode = Bytecode::CODE_##x;                      \
-		return code->x(arg);                                  \
+		return lastOpcodePos = code->x(arg);                  \
 	}                                                         \
 	size_t x(size_t pos, z arg) { return code->x(pos, arg); } \
 	size_t x(z arg, Token t) {                                \
@@ -50,7 +51,7 @@ struct BytecodeCompilationContext {
 #define OPCODE2(x, y, z, w)                                                   \
 	size_t x(z arg1, w arg2) {                                                \
 		lastOpcode = Bytecode::CODE_##x;                                      \
-		return code->x(arg1, arg2);                                           \
+		return lastOpcodePos = code->x(arg1, arg2);                           \
 	}                                                                         \
 	size_t x(size_t pos, z arg1, w arg2) { return code->x(pos, arg1, arg2); } \
 	size_t x(z arg1, w arg2, Token t) {                                       \
@@ -61,6 +62,12 @@ struct BytecodeCompilationContext {
 
 	size_t getip() { return code->getip(); }
 	void   insert_token(Token t);
+	// drops the code from 'ip' to the end, along with its
+	// tokens
+	void discard(size_t ip);
+	// moves the tokens to the new ips of their opcodes, which
+	// are stored at their old ips in 'ips'
+	void relocate(const size_t *ips);
 	void   finalize();
 	Token  get_token(size_t ip);
 
@@ -140,12 +147,12 @@ struct BytecodeCompilationContext {
 	}
 
 	int load_field_(int field) {
-		code->load_field_fast(code->add_constant(ValueNil, false), 0);
+		code->load_field_fast(code->add_field_cache(), 0);
 		return load_field(field);
 	}
 
 	int store_field_(int field) {
-		code->store_field_fast(code->add_constant(ValueNil, false), 0);
+		code->store_field_fast(code->add_field_cache(), 0);
 		return store_field(field);
 	}
 
@@ -162,16 +169,47 @@ struct BytecodeCompilationContext {
 			    Bytecode::CODE_store_slot_pop;
 			code->stackEffect(-1);
 			lastOpcode = Bytecode::CODE_store_slot_pop;
+		} else if(lastOpcode == Bytecode::CODE_store_object_slot) {
+			lastOpcode = code->bytecodes[lastOpcodePos] =
+			    Bytecode::CODE_store_object_slot_pop;
+			code->stackEffect(-1);
 		} else {
 			code->pop();
 			lastOpcode = Bytecode::CODE_pop;
 		}
 	}
 
+	// if the last opcode is a comparison, it is replaced with
+	// its fused form, which performs the jump by itself. the
+	// jumpiffalse is still emitted, so that it can be patched
+	// and jumped to as usual.
+	size_t jumpiffalse_(int offset) {
+		// number of opcodes taken by an operand
+		const size_t w = sizeof(int) / sizeof(Bytecode::Opcode);
+		switch(lastOpcode) {
+#define REGISTER_OPCODE(x)
+#define COMPARE_FORM(x, ops)                             \
+	case Bytecode::CODE_##x:                             \
+		if(lastOpcodePos + 1 + ops * w == code->getip()) \
+			code->bytecodes[lastOpcodePos] =             \
+			    Bytecode::CODE_##x##_jumpiffalse;        \
+		break;
+#define COMPARE_OPCODE(x)   \
+	COMPARE_FORM(x, 0)      \
+	COMPARE_FORM(x##_ts, 1) \
+	COMPARE_FORM(x##_ss, 2) \
+	COMPARE_FORM(x##_tc, 1) \
+	COMPARE_FORM(x##_sc, 2)
+#include "../register_opcodes.h"
+#undef COMPARE_FORM
+			default: break;
+		}
+		return jumpiffalse(offset);
+	}
+
 	void prepare_fast_call(int args) {
 		code->push_back(Bytecode::Opcode::CODE_call_fast_prepare);
-		code->push_back((Bytecode::Opcode)code->add_constant(ValueNil, false));
-		code->add_constant(ValueNil, false);
+		code->push_back((Bytecode::Opcode)code->add_call_cache());
 		code->push_back((Bytecode::Opcode)args);
 	}
 
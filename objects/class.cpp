@@ -60,6 +60,7 @@ void Class::add_sym(int sym, Value v) {
 	if(functions->capacity <= sym) {
 		functions->resize(sym + 1);
 	}
+	Gc::writeBarrier(functions, v);
 	functions->values[sym] = v;
 	// we change the size of the array manually
 	// so that all functions can be marked in
@@ -125,10 +125,15 @@ void ClassCompilationContext::add_public_signature(
     const String2 &sig, Function *f, FunctionCompilationContext *fctx) {
 
 	// TODO: insert token here
+	Gc::writeBarrier(public_signatures, Value(sig));
+	Gc::writeBarrier(public_signatures, Value(f));
 	public_signatures->vv[Value(sig)] = Value(f);
 	compilingClass->add_fn(sig, f);
-	if(fctx)
+	if(fctx) {
+		Gc::writeBarrier(fctxMap, Value(sig));
+		Gc::writeBarrier(fctxMap, Value(fctx));
 		fctxMap->vv[Value(sig)] = Value(fctx);
+	}
 	if(f->isStatic() && metaclass) {
 		metaclass->add_fn(sig, f);
 	}
@@ -163,13 +168,18 @@ bool ClassCompilationContext::add_public_fn(const String2 &sig, Function *f,
 void ClassCompilationContext::add_private_signature(
     const String2 &sig, Function *f, FunctionCompilationContext *fctx) {
 	// TODO: insert token here
+	Gc::writeBarrier(private_signatures, Value(sig));
+	Gc::writeBarrier(private_signatures, Value(f));
 	private_signatures->vv[Value(sig)] = Value(f);
 	// append the signature with "p " so that it cannot
 	// be invoked as a method outside of the class
 	String2 priv_signature = String::append("p ", sig);
 	compilingClass->add_fn(priv_signature, f);
-	if(fctx)
+	if(fctx) {
+		Gc::writeBarrier(fctxMap, Value(sig));
+		Gc::writeBarrier(fctxMap, Value(fctx));
 		fctxMap->vv[Value(sig)] = Value(fctx);
+	}
 	// we don't need to add anything to the metaclass
 }
 
@@ -216,6 +226,8 @@ int ClassCompilationContext::get_fn_sym(const String2 &sig) {
 }
 
 FunctionCompilationContext *ClassCompilationContext::get_func_ctx(Value sig) {
+	// operator[] inserts the key if it is not present
+	Gc::writeBarrier(fctxMap, sig);
 	return fctxMap->vv[sig].toFunctionCompilationContext();
 }
 
@@ -229,8 +241,11 @@ void ClassCompilationContext::add_public_class(Class *                  c,
 	// if the ctx is null, it is a builtin class,
 	// and it won't query for its ctx anytime.
 	// so don't populate the map
-	if(ctx != NULL)
+	if(ctx != NULL) {
+		Gc::writeBarrier(cctxMap, Value(c->name));
+		Gc::writeBarrier(cctxMap, Value(ctx));
 		cctxMap->vv[Value(c->name)] = Value(ctx);
+	}
 	c->module = compilingClass;
 }
 
@@ -241,18 +256,26 @@ void ClassCompilationContext::add_private_class(Class *                  c,
 	int modSlot = get_mem_slot(c->name);
 	defaultConstructor->bcc->push(Value(c));
 	defaultConstructor->bcc->store_object_slot(modSlot);
-	if(ctx != NULL)
+	if(ctx != NULL) {
+		Gc::writeBarrier(cctxMap, Value(c->name));
+		Gc::writeBarrier(cctxMap, Value(ctx));
 		cctxMap->vv[Value(c->name)] = Value(ctx);
+	}
 	c->module = compilingClass;
 }
 
 bool ClassCompilationContext::has_class(String *name) {
-	return has_mem(name) && cctxMap->vv[Value(name)] != ValueNil;
+	if(!has_mem(name))
+		return false;
+	// operator[] inserts the key if it is not present
+	Gc::writeBarrier(cctxMap, Value(name));
+	return cctxMap->vv[Value(name)] != ValueNil;
 }
 
 ClassCompilationContext *ClassCompilationContext::get_class_ctx(String *name) {
 	// mark the member as declared
 	members[0][name].isDeclared = true;
+	Gc::writeBarrier(cctxMap, Value(name));
 	return cctxMap->vv[Value(name)].toClassCompilationContext();
 }
 
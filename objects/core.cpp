@@ -121,6 +121,162 @@ Value next_core_gc(const Value *args, int numargs) {
 	return ValueNil;
 }
 
+Value next_core_gc_compact(const Value *args, int numargs) {
+	(void)args;
+	(void)numargs;
+	return Value((int64_t)Gc::compact());
+}
+
+Value next_core_gc_incremental(const Value *args, int numargs) {
+	(void)numargs;
+	EXPECT(core, "gc_incremental(_)", 1, Integer);
+	int64_t budget = args[1].toInteger();
+	if(budget < 0) {
+		RERR("Incremental marking budget must be non negative!");
+	}
+	Gc::setIncrementalBudget(budget);
+	return ValueNil;
+}
+
+Value next_core_gc_mark_threads(const Value *args, int numargs) {
+	(void)numargs;
+	EXPECT(core, "gc_mark_threads(_)", 1, Integer);
+	int64_t n = args[1].toInteger();
+	if(n < 1) {
+		RERR("Number of marking threads must be positive!");
+	}
+#ifdef GC_PARALLEL_MARK
+	Gc::setMarkThreads(n);
+#else
+	if(n != 1) {
+		RERR("Parallel marking is not enabled in this build!");
+	}
+#endif
+	return ValueNil;
+}
+
+Value next_core_gc_pause_histogram(const Value *args, int numargs) {
+	(void)args;
+	(void)numargs;
+	Array2 a = Array::create(GC_PAUSE_HISTOGRAM_BUCKETS);
+	for(size_t i = 0; i < GC_PAUSE_HISTOGRAM_BUCKETS; i++)
+		a->insert(Value((int64_t)Gc::pauseHistogram[i]));
+	return a;
+}
+
+// stores v in m with key as the name. v must
+// be reachable, since the key is allocated here.
+static void setStat(Map *m, const char *key, Value v) {
+	Value k = Value(String::from(key));
+	m->vv[k] = v;
+	Gc::writeBarrier(m, k);
+	Gc::writeBarrier(m, v);
+}
+
+static void setStat(Map *m, const char *key, size_t v) {
+	setStat(m, key, Value((int64_t)v));
+}
+
+Value next_core_gc_stats(const Value *args, int numargs) {
+	(void)args;
+	(void)numargs;
+	Gc::Stats s;
+	Gc::stats(s);
+	Map2 m = Map::create();
+	setStat(m, "allocated", Gc::totalAllocated);
+	setStat(m, "next_gc", Gc::next_gc);
+	setStat(m, "large_allocated", Gc::largeAllocated);
+	setStat(m, "next_large_gc", Gc::next_large_gc);
+	setStat(m, "pauses", Gc::numPauses);
+	setStat(m, "total_pause_us", Gc::totalPause);
+	setStat(m, "max_pause_us", Gc::maxPause);
+	Array2 gens = Array::create(GC_NUM_GENERATIONS);
+	setStat(m, "generations", Value(gens));
+	for(size_t i = 0; i < GC_NUM_GENERATIONS; i++) {
+		Map2 g = Map::create();
+		gens->insert(Value(g));
+		setStat(g, "collections", Gc::numCollections[i]);
+		setStat(g, "objects", s.objects[i]);
+		setStat(g, "bytes", s.bytes[i]);
+	}
+	Map2 unswept = Map::create();
+	setStat(m, "unswept", Value(unswept));
+	setStat(unswept, "objects", s.unsweptObjects);
+	setStat(unswept, "bytes", s.unsweptBytes);
+	Map2 types = Map::create();
+	setStat(m, "types", Value(types));
+	Map2 t;
+#define OBJTYPE(n, c)                                           \
+	t = Map::create();                                          \
+	setStat(types, #n, Value(t));                               \
+	setStat(t, "allocations",                                   \
+	        Gc::typeAllocations[(size_t)GcObject::Type::n]);    \
+	setStat(t, "bytes", Gc::typeAllocatedBytes[(size_t)GcObject::Type::n]);
+#include "../objecttype.h"
+	Map2 memory = Map::create();
+	setStat(m, "memory", Value(memory));
+	setStat(memory, "pool_used", s.poolUsed);
+	setStat(memory, "pool_resident", s.poolResident);
+	setStat(memory, "large_cache_resident", s.largeCacheResident);
+	setStat(memory, "nursery_free_blocks", s.nurseryFreeBlocks);
+	return Value(m);
+}
+
+static void collectFunction(GcObject *o, void *data) {
+	if(o->isFunction() && ((Function *)o)->getType() == Function::METHOD)
+		((Array *)data)->insert(Value(o));
+}
+
+Value next_core_call_cache_stats(const Value *args, int numargs) {
+	(void)args;
+	(void)numargs;
+	// the array keeps the functions alive while the
+	// stats are allocated, and is only grown in between
+	Array2 functions = Array::create(1);
+	Gc::walk(collectFunction, (Array *)functions);
+	Array2 sites = Array::create(1);
+	for(int i = 0; i < functions->size; i++) {
+		Function *f = functions->values[i].toFunction();
+		Bytecode *b = f->code;
+		for(size_t ip = 0; ip < b->size;) {
+			Bytecode::Opcode op    = b->bytecodes[ip];
+			const char *     state = nullptr;
+			switch(op) {
+				case Bytecode::CODE_call_fast_builtin_soft:
+				case Bytecode::CODE_call_fast_method_soft:
+				case Bytecode::CODE_call_fast_builtin:
+				case Bytecode::CODE_call_fast_method:
+					state = "monomorphic";
+					break;
+				case Bytecode::CODE_call_fast_poly:
+					state = "polymorphic";
+					break;
+				case Bytecode::CODE_call_fast_mega:
+					state = "megamorphic";
+					break;
+				default: break;
+			}
+			if(state != nullptr) {
+				Value *cache = &b->values[b->bytecodes[ip + 1]];
+				size_t classes = 0;
+				for(int j = 0; j < Bytecode::CallCacheHits; j += 2)
+					classes += cache[j] != ValueNil;
+				Map2 m = Map::create();
+				sites->insert(Value(m));
+				setStat(m, "function", Value(f->name));
+				setStat(m, "call",
+				        Value(SymbolTable2::getString(b->bytecodes[ip + 4])));
+				setStat(m, "state", Value(String::from(state)));
+				setStat(m, "classes", classes);
+				setStat(m, "hits", cache[Bytecode::CallCacheHits]);
+				setStat(m, "misses", cache[Bytecode::CallCacheMisses]);
+			}
+			ip += Bytecode::OpcodeLengths[op];
+		}
+	}
+	return Value(sites);
+}
+
 Value next_core_input0(const Value *args, int numargs) {
 	(void)args;
 	(void)numargs;
@@ -330,6 +486,12 @@ void addCoreFunctions(BuiltinModule *m) {
 	m->add_builtin_fn("yield()", 0, next_core_yield_0, false);  // can switch
 	m->add_builtin_fn("yield(_)", 1, next_core_yield_1, false); // can switch
 	m->add_builtin_fn("gc()", 0, next_core_gc);
+	m->add_builtin_fn("gc_compact()", 0, next_core_gc_compact);
+	m->add_builtin_fn("gc_incremental(_)", 1, next_core_gc_incremental);
+	m->add_builtin_fn("gc_pause_histogram()", 0, next_core_gc_pause_histogram);
+	m->add_builtin_fn("gc_stats()", 0, next_core_gc_stats);
+	m->add_builtin_fn("call_cache_stats()", 0, next_core_call_cache_stats);
+	m->add_builtin_fn("gc_mark_threads(_)", 1, next_core_gc_mark_threads);
 	m->add_builtin_fn("input()", 0, next_core_input0);
 	m->add_builtin_fn("exit()", 0, next_core_exit);
 	m->add_builtin_fn("exit(_)", 1, next_core_exit1);
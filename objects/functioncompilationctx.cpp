@@ -11,6 +11,7 @@ FunctionCompilationContext *FunctionCompilationContext::create(String2 name,
 	fcc->bcc                        = NULL;
 	fcc->f                          = NULL;
 	fcc->slotmap                    = NULL;
+	fcc->inlineBody                 = NULL;
 	// initialize the members
 	fcc->slotmap = (SlotMap *)Gc_malloc(sizeof(SlotMap));
 	::new(fcc->slotmap) SlotMap();
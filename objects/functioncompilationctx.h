@@ -4,6 +4,7 @@
 #include "function.h"
 
 struct Bytecode;
+struct Statement;
 
 struct FunctionCompilationContext {
 	GcObject obj;
@@ -18,6 +19,9 @@ struct FunctionCompilationContext {
 	Function *                       f;
 	BytecodeCompilationContext *     bcc;
 	int                              slotCount;
+	// the body of the function, if it is small enough to be
+	// inlined by the code generator
+	Statement *inlineBody;
 
 	int                         create_slot(Value s, int scopeID);
 	bool                        has_slot(Value s, int scopeID);
@@ -31,6 +35,8 @@ struct FunctionCompilationContext {
 	void mark() {
 		Gc::mark(f);
 		Gc::mark(bcc);
+		if(inlineBody)
+			Gc::mark(inlineBody);
 		for(auto &a : *slotmap) {
 			Gc::mark(a.first);
 		}
@@ -80,7 +80,10 @@ Value next_map_set(const Value *args, int numargs) {
 	Value h;
 	if(!ExecutionEngine::getHash(args[1], &h))
 		return ValueNil;
-	return args[0].toMap()->vv[h] = args[2];
+	Map *m = args[0].toMap();
+	Gc::writeBarrier(m, h);
+	Gc::writeBarrier(m, args[2]);
+	return m->vv[h] = args[2];
 }
 
 Value next_map_str(const Value *args, int numargs) {
@@ -152,6 +155,9 @@ Map *Map::from(const Value *args, int numArg) {
 		Value value = args[i + 1];
 		if(!ExecutionEngine::getHash(key, &key))
 			return vm;
+		// getHash may have triggered a gc
+		Gc::writeBarrier(vm, key);
+		Gc::writeBarrier(vm, value);
 		vm->vv[key] = value;
 	}
 	return vm;
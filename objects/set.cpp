@@ -21,6 +21,7 @@ Value next_set_insert(const Value *args, int numargs) {
 	Value h;
 	if(!ExecutionEngine::getHash(args[1], &h))
 		return ValueNil;
+	Gc::writeBarrier(args[0].toSet(), h);
 	auto res = args[0].toSet()->hset.insert(h);
 	return Value(res.second);
 }
@@ -26,7 +26,9 @@ int64_t SymbolTable2::insert(const String2 &str) {
 	Value s = Value(str);
 	if(stringMap->vv.contains(s))
 		return stringMap->vv[s].toInteger();
-	Value id         = Value(counter++);
+	Value id = Value(counter++);
+	Gc::writeBarrier(stringMap, s);
+	Gc::writeBarrier(intMap, s);
 	stringMap->vv[s] = id;
 	intMap->vv[id]   = s;
 	return id.toInteger();
@@ -75,6 +75,7 @@ Value next_tuple_set(const Value *args, int numargs) {
 		effective_idx += t->size;
 	}
 	if(effective_idx < t->size) {
+		Gc::writeBarrier(t, args[2]);
 		return t->values()[effective_idx] = args[2];
 	}
 	if(t->size == 0) {
@@ -70,6 +70,61 @@ OPCODE0(lesseq, -1)
 OPCODE0(greater, -1)
 OPCODE0(greatereq, -1)
 
+// register forms of the above, which read their operands
+// directly from the local slots, instead of loading them
+// to the stack first. if the operands are not numbers,
+// they are pushed, and the operator method is called on
+// them as usual.
+// <op>_ss pushes <slot1> <op> <slot2>
+#define REGISTER_OPCODE(x) OPCODE2(x##_ss, 1, int, int) // <slot1> <slot2>
+#include "register_opcodes.h"
+// <op>_ts replaces TOS with TOS <op> <slot>
+#define REGISTER_OPCODE(x) OPCODE1(x##_ts, 0, int) // <slot>
+#include "register_opcodes.h"
+// <op>_sss is always followed by a store_slot_pop <dest>,
+// which it performs by itself, and skips over. when the
+// operator method is called, the store is performed
+// on the returned value.
+#define REGISTER_OPCODE(x) OPCODE2(x##_sss, 1, int, int) // <slot1> <slot2>
+#include "register_opcodes.h"
+
+// superinstructions, fusing the opcode sequences which are
+// executed the most by the benchmarks, as counted by
+// util/opcode_ngrams.py. they fall back to the operator
+// methods like the register forms.
+// <op>_tc replaces TOS with TOS <op> <constant>
+#define REGISTER_OPCODE(x) OPCODE1(x##_tc, 0, Value) // <constant>
+#include "register_opcodes.h"
+// <op>_sc pushes <slot> <op> <constant>
+#define REGISTER_OPCODE(x) OPCODE2(x##_sc, 1, int, Value) // <slot> <constant>
+#include "register_opcodes.h"
+// <cmp>_jumpiffalse replaces the opcode of a comparison
+// which is followed by a jumpiffalse, keeping its operands.
+// it performs the jump by itself, and skips over it. when
+// the operator method is called, the jump is performed on
+// the returned value.
+#define REGISTER_OPCODE(x)
+#define COMPARE_OPCODE(x)                    \
+	OPCODE0(x##_jumpiffalse, -1)             \
+	OPCODE1(x##_ts_jumpiffalse, 0, int)      \
+	OPCODE2(x##_ss_jumpiffalse, 1, int, int) \
+	OPCODE1(x##_tc_jumpiffalse, 0, Value)    \
+	OPCODE2(x##_sc_jumpiffalse, 1, int, Value)
+#include "register_opcodes.h"
+
+// quickened forms of the stack operators. the engine rewrites
+// an operator to them in place once it has seen the operand
+// types, and they rewrite themselves back to the operator
+// when their guard fails.
+// <op>_int_int is the operator on two small integers
+#define REGISTER_OPCODE(x) OPCODE0(x##_int_int, -1)
+#include "register_opcodes.h"
+// <op>_num_num is the operator on two numbers
+#define REGISTER_OPCODE(x) OPCODE0(x##_num_num, -1)
+#include "register_opcodes.h"
+// concatenates two strings
+OPCODE0(add_str_str, -1)
+
 OPCODE1(bcall_fast_prepare, 0, int)
 // OPCODE1(bcall_fast_method, 0, int)
 // OPCODE1(bcall_fast_builtin, 0, int)
@@ -136,6 +191,7 @@ OPCODE1(store_slot_pop, -1, int) // <slot_number>
 OPCODE1(store_tos_slot, -1, int)
 // Store TOS to <slot> of slot 0
 OPCODE1(store_object_slot, 0, int)
+OPCODE1(store_object_slot_pop, -1, int)
 // Stores in the static slot of the receiver
 // Since static slots are bound to the
 // class directly, and subclasses can
@@ -218,6 +274,16 @@ OPCODE2(call_fast_builtin_soft, 0, int, int) // <index_start> <arity>
 OPCODE2(call_fast_method_soft, 0, int, int)  // <index_start> <arity>
 OPCODE2(call_fast_builtin, 0, int, int)      // <index_start> <arity>
 OPCODE2(call_fast_method, 0, int, int)       // <index_start> <arity>
+// once a call site has seen a second class, it is patched to
+// call_fast_poly, which compares the class of the receiver
+// with each of the cached classes in turn, and calls the
+// function of the matching one. once all of them are filled,
+// it is patched to call_fast_mega, which looks the function
+// up in a cache shared by all the call sites, keyed by the
+// class and the symbol of the call that follows. the _soft
+// calls are only ever monomorphic.
+OPCODE2(call_fast_poly, 0, int, int) // <index_start> <arity>
+OPCODE2(call_fast_mega, 0, int, int) // <index_start> <arity>
 
 // return
 OPCODE0(ret, -1)
@@ -232,6 +298,10 @@ OPCODE1(load_field, 0, int) // <symbol>
 OPCODE2(load_field_fast, 0, int, int)
 OPCODE2(load_field_slot, 0, int, int)   // <index> <slot>
 OPCODE2(load_field_static, 0, int, int) // <index> <slot>
+// Patched by load_field once the site has seen the slots of
+// more than one class, checks the (class, slot) pairs
+// cached at <index>
+OPCODE2(load_field_poly, 0, int, int) // <index> <unused>
 // Pop the object from TOS and assign
 // the value at present TOS to the field
 OPCODE1(store_field, -1, int) // <symbol>
@@ -239,6 +309,7 @@ OPCODE1(store_field, -1, int) // <symbol>
 OPCODE2(store_field_fast, 0, int, int)
 OPCODE2(store_field_slot, 0, int, int)   // <index> <slot>
 OPCODE2(store_field_static, 0, int, int) // <index> <slot>
+OPCODE2(store_field_poly, 0, int, int)   // <index> <unused>
 
 // Pops the value at TOS and starts stack unwinding
 // until a frame with matching exception handler is
@@ -602,7 +602,13 @@ Expression *LiteralParselet::parse(Parser *parser, Token t) {
 			if(end == NULL || end - start < t.length) {
 				throw ParseException(t, "Not a valid number!");
 			}
-			return NewExpression(Literal, Value(val), t);
+			// numbers written with a fraction or an exponent are
+			// kept as doubles, see value.h
+			Value v = Value(val);
+			if(memchr(start, '.', t.length) || memchr(start, 'e', t.length) ||
+			   memchr(start, 'E', t.length))
+				v.setDouble(val);
+			return NewExpression(Literal, v, t);
 		}
 		// for hex bin and octs, 0 followed by specifier
 		// is invalid
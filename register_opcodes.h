@@ -0,0 +1,20 @@
+// operators which have register forms in opcodes.h
+// REGISTER_OPCODE(opcode)
+// the comparisons are listed with COMPARE_OPCODE, which
+// can be defined to only expand those.
+#ifndef REGISTER_OPCODE
+#define REGISTER_OPCODE(x)
+#endif
+#ifndef COMPARE_OPCODE
+#define COMPARE_OPCODE(x) REGISTER_OPCODE(x)
+#endif
+REGISTER_OPCODE(add)
+REGISTER_OPCODE(sub)
+REGISTER_OPCODE(mul)
+REGISTER_OPCODE(div)
+COMPARE_OPCODE(less)
+COMPARE_OPCODE(lesseq)
+COMPARE_OPCODE(greater)
+COMPARE_OPCODE(greatereq)
+#undef COMPARE_OPCODE
+#undef REGISTER_OPCODE
@@ -122,6 +122,9 @@ class Scanner {
 	Token                     scanNextToken();
 	const CustomArray<Token> &scanAllTokens();
 	bool                      hasScanErrors();
+	// the scanned source, and the name of its file
+	const void *getSource() { return source.source; }
+	const void *getFileName() { return fileName.source; }
 
 	friend Token;
 };
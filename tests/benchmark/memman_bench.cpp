@@ -0,0 +1,160 @@
+// microbenchmark for the MemoryManager. for every size class
+// up to blockEnd, it allocates and releases blocks in a few
+// different interleavings, and prints the average time taken
+// by a malloc/free pair. the first and last words of the blocks
+// are tagged, and checked before they are released, so
+// overlapping blocks are caught.
+//
+// usage: memman_bench [num_threads]
+
+#include "memman.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+static const size_t numBlocks  = 4096;
+static const size_t numRounds  = 64;
+static const size_t numRandoms = numBlocks * numRounds;
+static const size_t numBursts  = numBlocks * 16;
+
+static void fill(void *mem, size_t size, size_t tag) {
+	size_t *m                    = (size_t *)mem;
+	m[0]                         = tag;
+	m[size / sizeof(size_t) - 1] = tag;
+}
+
+static void check(void *mem, size_t size, size_t tag) {
+	size_t *m = (size_t *)mem;
+	if(m[0] != tag || m[size / sizeof(size_t) - 1] != tag) {
+		std::fprintf(stderr, "block %p of size %zu is corrupted!\n", mem,
+		             size);
+		std::exit(1);
+	}
+}
+
+static void release(void *mem, size_t size, size_t tag) {
+	check(mem, size, tag);
+	MemoryManager::free(mem, size);
+}
+
+// allocates everything, and releases them in the reverse order
+static void lifo(std::vector<void *> &blocks, size_t size) {
+	for(size_t r = 0; r < numRounds; r++) {
+		for(size_t i = 0; i < numBlocks; i++) {
+			blocks[i] = MemoryManager::malloc(size);
+			fill(blocks[i], size, i);
+		}
+		for(size_t i = numBlocks; i > 0;) {
+			--i;
+			release(blocks[i], size, i);
+		}
+	}
+}
+
+// allocates everything, and releases them in the same order
+static void fifo(std::vector<void *> &blocks, size_t size) {
+	for(size_t r = 0; r < numRounds; r++) {
+		for(size_t i = 0; i < numBlocks; i++) {
+			blocks[i] = MemoryManager::malloc(size);
+			fill(blocks[i], size, i);
+		}
+		for(size_t i = 0; i < numBlocks; i++) release(blocks[i], size, i);
+	}
+}
+
+// keeps numBlocks blocks alive, and replaces a random one
+// on each step, which scatters the free blocks among the
+// pools
+static void scattered(std::vector<void *> &blocks, size_t size) {
+	for(size_t i = 0; i < numBlocks; i++) {
+		blocks[i] = MemoryManager::malloc(size);
+		fill(blocks[i], size, i);
+	}
+	uint32_t x = 2463534242u;
+	for(size_t r = 0; r < numRandoms; r++) {
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		size_t i = x % numBlocks;
+		release(blocks[i], size, i);
+		blocks[i] = MemoryManager::malloc(size);
+		fill(blocks[i], size, i);
+	}
+	for(size_t i = 0; i < numBlocks; i++) release(blocks[i], size, i);
+}
+
+// allocates a burst of blocks spanning a lot of arenas,
+// and releases them in a random order
+static void burst(std::vector<void *> &blocks, size_t size) {
+	for(size_t i = 0; i < numBursts; i++) {
+		blocks[i] = MemoryManager::malloc(size);
+		fill(blocks[i], size, i);
+	}
+	// shuffle them
+	uint32_t x = 2463534242u;
+	for(size_t i = numBursts - 1; i > 0; i--) {
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		size_t j = x % (i + 1);
+		std::swap(blocks[i], blocks[j]);
+	}
+	for(size_t i = 0; i < numBursts; i++) {
+		check(blocks[i], size, ((size_t *)blocks[i])[0]);
+		MemoryManager::free(blocks[i], size);
+	}
+}
+
+struct Pattern {
+	const char *name;
+	void (*run)(std::vector<void *> &, size_t);
+	size_t pairs;
+};
+
+static const Pattern patterns[] = {
+    {"lifo", lifo, numBlocks * numRounds},
+    {"fifo", fifo, numBlocks * numRounds},
+    {"random", scattered, numRandoms + numBlocks},
+    {"burst", burst, numBursts}};
+
+// runs the pattern for all size classes, and returns
+// the total number of seconds it took
+static double runPattern(const Pattern &p) {
+	std::vector<void *> blocks(numBursts);
+	auto                start = Clock::now();
+	for(size_t size = MemoryManager::blockWidth; size <= MemoryManager::blockEnd;
+	    size += MemoryManager::blockWidth)
+		p.run(blocks, size);
+	return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+int main(int argc, char *argv[]) {
+	size_t numThreads = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1;
+	if(numThreads == 0)
+		numThreads = 1;
+	MemoryManager::init();
+	std::printf("%zu thread(s), %zu size classes\n", numThreads,
+	            MemoryManager::blockCount);
+	double total = 0;
+	for(const Pattern &p : patterns) {
+		std::vector<double>      elapsed(numThreads);
+		std::vector<std::thread> threads;
+		for(size_t i = 1; i < numThreads; i++)
+			threads.emplace_back([&, i] { elapsed[i] = runPattern(p); });
+		elapsed[0] = runPattern(p);
+		for(std::thread &t : threads) t.join();
+		double max = 0;
+		for(double e : elapsed) max = e > max ? e : max;
+		size_t ops = p.pairs * MemoryManager::blockCount * numThreads;
+		std::printf("%-8s: %8.3f s, %6.2f ns per malloc/free\n", p.name, max,
+		            max * 1e9 / ops);
+		total += max;
+	}
+	std::printf("elapsed: %f\n", total);
+	return 0;
+}
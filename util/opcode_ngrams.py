@@ -0,0 +1,93 @@
+#!/usr/bin/env python
+
+# Counts the opcode n-grams executed by the benchmarks.
+#
+# It runs each benchmark in tests/benchmark with an interpreter built by
+# 'make opcode_profile', which writes the number of times each opcode, each
+# pair of consecutive opcodes, and each triple of them was executed to the
+# file named by NEXT_OPCODE_PROFILE. The counts are then summed up over all
+# the benchmarks, and the most frequent pairs and triples are printed along
+# with their share of the dispatches, which makes them the candidates for
+# superinstructions.
+#
+# A pattern can be passed to only run the matching benchmarks.
+
+from __future__ import print_function
+
+import argparse
+import collections
+import os
+import os.path
+import re
+import subprocess
+import sys
+import tempfile
+
+NEXT_DIR = os.path.dirname(os.path.dirname(os.path.realpath(__file__)))
+BENCHMARK_DIR = os.path.join(NEXT_DIR, 'tests', 'benchmark')
+
+
+def run_benchmark(binary, path):
+    fd, profile = tempfile.mkstemp(suffix='.prof')
+    os.close(fd)
+    env = dict(os.environ, NEXT_OPCODE_PROFILE=profile)
+    try:
+        # the benchmarks import their modules relative to the root
+        if subprocess.call([binary, path], cwd=NEXT_DIR, env=env,
+                           stdout=subprocess.DEVNULL) != 0:
+            print("{} failed, skipping..".format(path), file=sys.stderr)
+            return collections.Counter()
+        counts = collections.Counter()
+        with open(profile) as f:
+            for line in f:
+                parts = line.split()
+                counts[tuple(parts[1:])] += int(parts[0])
+        return counts
+    finally:
+        os.remove(profile)
+
+
+def print_top(title, counts, n, total):
+    print(title)
+    for ngram, count in counts.most_common(n):
+        print("  {:>12} {:6.2f}%  {}".format(count, count * 100.0 / total,
+                                              " ".join(ngram)))
+    print()
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Count the opcode n-grams executed by the benchmarks")
+    parser.add_argument("benchmark", nargs='?', default=".*",
+                        help="only run the benchmarks matching this pattern")
+    parser.add_argument("--next", default=os.path.join(NEXT_DIR, "next"),
+                        help="interpreter built with 'make opcode_profile'")
+    parser.add_argument("-n", "--top", type=int, default=25,
+                        help="number of n-grams to show")
+    args = parser.parse_args()
+
+    pattern = re.compile(args.benchmark)
+    unigrams = collections.Counter()
+    pairs = collections.Counter()
+    triples = collections.Counter()
+    for name in sorted(os.listdir(BENCHMARK_DIR)):
+        if not name.endswith(".n") or not pattern.search(name[:-2]):
+            continue
+        print("Running {}..".format(name[:-2]), file=sys.stderr)
+        counts = run_benchmark(args.next, os.path.join(BENCHMARK_DIR, name))
+        for ngram, count in counts.items():
+            {1: unigrams, 2: pairs, 3: triples}[len(ngram)][ngram] += count
+
+    total = sum(unigrams.values())
+    if total == 0:
+        print("No opcodes were executed!", file=sys.stderr)
+        return 1
+    print("Total dispatches: {}\n".format(total))
+    print_top("Opcodes", unigrams, args.top, total)
+    print_top("Pairs", pairs, args.top, total)
+    print_top("Triples", triples, args.top, total)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
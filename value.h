@@ -19,11 +19,49 @@ struct Value {
 	//          ii) -110 denotes boolean
 	//              a. 1110 denotes true
 	//              b. 0110 denotes false
+	//      C. 1010 denotes a small integer in [-2^53, 2^53), stored in
+	//      the upper 60 bits. a number converted from a double is
+	//      stored as a small integer if it is one, but the arithmetic
+	//      on doubles, and the literals written with a fraction, keep
+	//      them as doubles, so an integral number may be stored either
+	//      way. equality and hashing treat a small integer as the
+	//      double it converts to.
 	//
 	inline void encodeBoolean(const bool b) {
 		val.value = (uint64_t)b << 3 | 0x6;
 	}
 	inline void encodeGcObject(const GcObject *g) { val.value = (uintptr_t)g; }
+	// i must fit in a small integer
+	inline void encodeSmallInteger(int64_t i) {
+		val.value = (uint64_t)i << 4 | 0xA;
+	}
+	inline void encodeInteger(int64_t i) {
+		if(fitsSmallInteger(i))
+			encodeSmallInteger(i);
+		else
+			encodeDouble((double)i);
+	}
+	inline void encodeDouble(double d) {
+		val.dvalue = d;
+		val.value |= 0x1;
+	}
+	inline void encodeNumber(double d) {
+		// false for nans
+		if(d >= -SmallIntegerLimit && d < SmallIntegerLimit) {
+			int64_t i = (int64_t)d;
+			if((double)i == d && (i != 0 || !std::signbit(d))) {
+				encodeSmallInteger(i);
+				return;
+			}
+		}
+		encodeDouble(d);
+	}
+
+	// small integers are in [-SmallIntegerLimit, SmallIntegerLimit)
+	static constexpr int64_t SmallIntegerLimit = (int64_t)1 << 53;
+	static constexpr bool    fitsSmallInteger(int64_t i) {
+		return i >= -SmallIntegerLimit && i < SmallIntegerLimit;
+	}
 
 	union ValueUnion {
 		uint64_t value;
@@ -31,16 +69,15 @@ struct Value {
 
 		constexpr explicit ValueUnion() : value(0) {}
 		constexpr explicit ValueUnion(uint64_t v) : value(v) {}
-		explicit ValueUnion(double d) : dvalue(d) { value |= 0x1; }
 
 	} val;
 	enum class Type : int { Number = 0, Nil = 1, Boolean = 2, Object = 3 };
 	constexpr Value() : val((uint64_t)2) {}
 	constexpr Value(ValueUnion u) : val(u) {}
-	Value(double d) : val(d) {}
-	Value(int64_t l) : val((double)l) {}
+	Value(double d) { encodeNumber(d); }
+	Value(int64_t l) { encodeInteger(l); }
 	Value(size_t s) : Value((int64_t)s) {}
-	Value(int i) : val((double)i) {}
+	Value(int i) { encodeSmallInteger(i); }
 
 #ifdef DEBUG
 #define TYPE(r, n)                                                        \
@@ -84,20 +121,35 @@ struct Value {
 			return Type::Object;
 		if(lastChunk == 2)
 			return Type::Nil;
+		if(lastChunk == 0xA)
+			return Type::Number;
 		return Type::Boolean;
 	}
 	String *getTypeString() const { return ValueTypeStrings[(int)getType()]; }
 
 	inline bool is(Type ty) const { return getType() == ty; }
-	inline bool isBoolean() const { return (val.value & 0xF) >= 0x6; }
+	inline bool isBoolean() const { return (val.value & 0x7) == 0x6; }
 	inline bool isGcObject() const { return (val.value & 0x3) == 0; }
 #define OBJTYPE(n, c) \
 	inline bool is##n() const { return isGcObject() && toGcObject()->is##n(); }
 #include "objecttype.h"
 	inline bool isNil() const { return val.value == 0x2; }
-	inline bool isNumber() const { return val.value & 0x1; }
+	inline bool isNumber() const {
+		return (val.value & 0x1) || isSmallInteger();
+	}
+	inline bool isSmallInteger() const { return (val.value & 0xF) == 0xA; }
+	inline bool isDouble() const { return val.value & 0x1; }
+	// whether both of the values are small integers, and
+	// whether both of them are doubles
+	static inline bool areSmallIntegers(Value a, Value b) {
+		return (((a.val.value ^ 0xA) | (b.val.value ^ 0xA)) & 0xF) == 0;
+	}
+	static inline bool areDoubles(Value a, Value b) {
+		return a.val.value & b.val.value & 0x1;
+	}
 	inline bool isInteger() const {
-		return isNumber() && floor(toNumber()) == toNumber();
+		return isSmallInteger() ||
+		       (isDouble() && floor(toDouble()) == toDouble());
 	}
 	inline bool isBit() const {
 		return isInteger() && ((toInteger() == 0) || (toInteger() == 1));
@@ -109,16 +161,53 @@ struct Value {
 #define OBJTYPE(r, c) \
 	inline r *to##r() const { return (r *)toGcObject(); }
 #include "objecttype.h"
-	inline double toNumber() const {
+	inline double toDouble() const {
 		ValueUnion num = val;
 		num.value &= ~(0x1);
 		return num.dvalue;
 	}
-	inline int64_t toInteger() const { return (int64_t)toNumber(); }
+	inline int64_t toSmallInteger() const { return (int64_t)val.value >> 4; }
+	// the small integer shifted left by 4 bits. these add,
+	// subtract and compare like the integers themselves.
+	inline int64_t toShiftedInteger() const {
+		return (int64_t)(val.value - 0xA);
+	}
+	inline double  toNumber() const {
+		return isSmallInteger() ? (double)toSmallInteger() : toDouble();
+	}
+	inline int64_t toInteger() const {
+		return isSmallInteger() ? toSmallInteger() : (int64_t)toDouble();
+	}
 #define TYPE(r, n) \
 	inline void set##n(r v) { encode##n(v); }
 #include "valuetypes.h"
-	inline void setNumber(double v) { operator=(v); }
+	inline void setNumber(double v) { encodeNumber(v); }
+	inline void setInteger(int64_t v) { encodeInteger(v); }
+	inline void setDouble(double v) { encodeDouble(v); }
+	// the product of two small integers. 0 times a negative
+	// number is -0, which is a double.
+	inline void setProduct(int64_t a, int64_t b) {
+		// the product of two 32 bit integers fits in an int64_t
+		if((uint64_t)(a + 0x80000000) <= 0xFFFFFFFF &&
+		   (uint64_t)(b + 0x80000000) <= 0xFFFFFFFF) {
+			int64_t p = a * b;
+			if(p != 0 || (a | b) >= 0) {
+				encodeInteger(p);
+				return;
+			}
+		}
+		encodeNumber((double)a * (double)b);
+	}
+	inline void setShiftedInteger(int64_t v) {
+		// the bits above the small integer are all the same
+		// if it fits
+		if((v << 6) >> 6 == v)
+			val.value = (uint64_t)v | 0xA;
+		else
+			encodeDouble((double)(v >> 4));
+	}
+	// adds one to a small integer, which is used as a counter
+	inline void increment() { val.value += 1 << 4; }
 
 #define TYPE(r, n)                        \
 	inline Value &operator=(const r &d) { \
@@ -133,19 +222,31 @@ struct Value {
 #include "objecttype.h"
 #include "valuetypes.h"
 	inline Value &operator=(const double &v) {
-		val.dvalue = v;
-		val.value |= 1;
+		encodeNumber(v);
 		return *this;
 	}
 
-	constexpr inline bool operator==(const Value &v) const {
-		return v.val.value == val.value;
+	// the bits of the number as a double, see the value format
+	inline uint64_t doubleBits() const {
+		if(!isSmallInteger())
+			return val.value;
+		Value d;
+		d.encodeDouble((double)toSmallInteger());
+		return d.val.value;
 	}
 
-	constexpr inline bool operator!=(const Value &v) const {
-		return v.val.value != val.value;
+	// a small integer and a double with different bits can
+	// still hold the same number
+	inline bool operator==(const Value &v) const {
+		return v.val.value == val.value ||
+		       (isSmallInteger() && v.isDouble() &&
+		        doubleBits() == v.val.value) ||
+		       (isDouble() && v.isSmallInteger() &&
+		        v.doubleBits() == val.value);
 	}
 
+	inline bool operator!=(const Value &v) const { return !(*this == v); }
+
 	// since numbers, booleans and nils are stored unboxed,
 	// we cannot get their classes from the "object",
 	// so we stash their classes here, and return it.
@@ -181,17 +282,39 @@ struct Value {
 constexpr Value ValueNil{Value::ValueUnion((uint64_t)0x2)};
 constexpr Value ValueTrue{Value::ValueUnion((uint64_t)0xE)};
 constexpr Value ValueFalse{Value::ValueUnion((uint64_t)0x6)};
-// ieee754 0.0 is all zeros, we add a bit to the end to denote number
-constexpr Value ValueZero{Value::ValueUnion(uint64_t(1))};
+// 0 is a small integer
+constexpr Value ValueZero{Value::ValueUnion(uint64_t(0xA))};
+
+inline void Gc::writeBarrier(GcObject *holder, Value v) {
+	if(!v.isGcObject())
+		return;
+	GcObject *o = v.toGcObject();
+	// an older object now points to a younger one,
+	// so it has to be traced in minor collections
+	if(!holder->isRemembered() && o->getGeneration() < holder->getGeneration())
+		remember(holder);
+	// if the holder is already scanned, or is not going
+	// to be traced at all, the stored object has to be
+	// marked, otherwise it will not be traced in this cycle
+	if(isMarking && (holder->isMarked() ||
+	                 holder->getGeneration() > collectingGeneration))
+		mark(o);
+}
+
+#define OBJTYPE(r, n)                                  \
+	inline void Gc::writeBarrier(r *holder, Value v) { \
+		writeBarrier((GcObject *)holder, v);           \
+	}
+#include "objecttype.h"
 
 namespace std {
 	template <> struct hash<Value> {
-		std::size_t operator()(const Value &v) const { return v.val.value; }
+		std::size_t operator()(const Value &v) const { return v.doubleBits(); }
 	};
 
 	template <> struct equal_to<Value> {
 		bool operator()(const Value &v1, const Value &v2) const {
-			return v1.toBits() == v2.toBits();
+			return v1 == v2;
 		}
 	};
 } // namespace std